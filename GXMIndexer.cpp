@@ -0,0 +1,419 @@
+#include "GXMPlayer.h"
+#include "GXMIndexer.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <malloc.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <atomic>
+
+#define INDEXER_THREADS_MAX 64
+
+namespace GXMIndexer
+{
+    struct FileItem
+    {
+        char *Path;                 //Dir/..., opened when probing
+        const char *RelPath;        //Part of Path after Dir/, stored in the index
+        IndexEntry Entry;
+    };
+
+    //Each worker owns a slice of the file list and steals from other slices once its own is empty
+    struct WorkSlice
+    {
+        std::atomic<int32_t> Next;
+        int32_t End;
+    };
+
+    static FileItem *Files;
+    static int32_t FileNum;
+    static int32_t FileCap;
+    static size_t RelOfs;           //Where paths under Dir continue after Dir/
+
+    static WorkSlice *Slices;
+    static int SliceNum;
+
+    static std::atomic<int32_t> ProbedNum;
+
+    static bool IsModuleName(const char *Name)
+    {
+        size_t Leng = strlen(Name);
+        return Leng > 3 && strcasecmp(Name + Leng - 3, ".xm") == 0;
+    }
+
+    static bool AddFile(const char *Path, const struct stat &FileStat)
+    {
+        if (FileNum >= FileCap)
+        {
+            int32_t NewCap = FileCap ? FileCap * 2 : 1024;
+            FileItem *NewFiles = (FileItem *)realloc(Files, NewCap * sizeof(FileItem));
+            if (NewFiles == NULL) return false;
+
+            Files = NewFiles;
+            FileCap = NewCap;
+        }
+
+        FileItem &Item = Files[FileNum];
+        Item.Path = strdup(Path);
+        if (Item.Path == NULL) return false;
+        Item.RelPath = Item.Path + RelOfs;
+
+        memset(&Item.Entry, 0, sizeof(IndexEntry));
+        Item.Entry.FileSize = FileStat.st_size;
+        Item.Entry.MTime = (int64_t)FileStat.st_mtim.tv_sec * 1000000000 + FileStat.st_mtim.tv_nsec;
+
+        FileNum ++;
+        return true;
+    }
+
+    static bool WalkDir(const char *Dir)
+    {
+        DIR *DirHandle = opendir(Dir);
+        if (DirHandle == NULL) return true;
+
+        size_t DirLeng = strlen(Dir);
+        const char *Separator = DirLeng > 0 && Dir[DirLeng - 1] == '/' ? "" : "/";
+        bool Result = true;
+
+        struct dirent *Ent;
+        while (Result && (Ent = readdir(DirHandle)) != NULL)
+        {
+            if (Ent->d_name[0] == '.') continue;
+
+            size_t PathLeng = DirLeng + strlen(Separator) + strlen(Ent->d_name);
+            char *Path = (char *)malloc(PathLeng + 1);
+            if (Path == NULL)
+            {
+                Result = false;
+                break;
+            }
+            sprintf(Path, "%s%s%s", Dir, Separator, Ent->d_name);
+
+            //lstat() so symlinks are skipped, a link back up the tree would recurse forever and
+            //a link to another directory would index the same files twice
+            struct stat FileStat;
+            if (lstat(Path, &FileStat) == 0)
+            {
+                if (S_ISDIR(FileStat.st_mode))
+                    Result = WalkDir(Path);
+                else if (S_ISREG(FileStat.st_mode) && IsModuleName(Ent->d_name) && PathLeng - RelOfs <= UINT16_MAX)
+                    Result = AddFile(Path, FileStat);
+            }
+
+            free(Path);
+        }
+
+        closedir(DirHandle);
+        return Result;
+    }
+
+    static int ComparePath(const void *A, const void *B)
+    {
+        return strcmp(((const FileItem *)A)->RelPath, ((const FileItem *)B)->RelPath);
+    }
+
+    static void ProbeFile(FileItem &Item)
+    {
+        IndexEntry &Entry = Item.Entry;
+        ProbedNum ++;
+
+        int Fd = open(Item.Path, O_RDONLY);
+        if (Fd < 0 || Entry.FileSize == 0 || Entry.FileSize > UINT32_MAX)
+        {
+            if (Fd >= 0) close(Fd);
+            return;
+        }
+
+        void *Mapping = mmap(NULL, Entry.FileSize, PROT_READ, MAP_PRIVATE, Fd, 0);
+        close(Fd);
+        if (Mapping == MAP_FAILED) return;
+
+        madvise(Mapping, Entry.FileSize, MADV_SEQUENTIAL);
+
+        GXMPlayer::ModuleInfo Info;
+        if (GXMPlayer::ProbeModule((const uint8_t *)Mapping, Entry.FileSize, &Info))
+        {
+            Entry.Valid = 1;
+            Entry.Channels = Info.NumOfChannels;
+            Entry.Orders = Info.SongLength;
+            Entry.SampleBytes = Info.SampleDataSize;
+            memcpy(Entry.SongName, Info.SongName, 20);
+        }
+
+        Entry.Hash = GXMPlayer::HashModule((const uint8_t *)Mapping, Entry.FileSize);
+
+        munmap(Mapping, Entry.FileSize);
+    }
+
+    static void IndexWorker(int Slice, const bool *NeedProbe)
+    {
+        int i = 0;
+        while (i < SliceNum)
+        {
+            WorkSlice &Work = Slices[(Slice + i) % SliceNum];
+
+            int32_t Job;
+            while ((Job = Work.Next.fetch_add(1)) < Work.End)
+            {
+                if (NeedProbe[Job]) ProbeFile(Files[Job]);
+            }
+
+            i ++;
+        }
+    }
+
+    //Copies entries of unchanged files from the previous index, everything else is flagged in NeedProbe
+    static void ReuseOldIndex(const char *IndexPath, bool *NeedProbe)
+    {
+        int i = 0;
+        while (i < FileNum)
+            NeedProbe[i++] = true;
+
+        int Fd = open(IndexPath, O_RDONLY);
+        if (Fd < 0) return;
+
+        struct stat FileStat;
+        if (fstat(Fd, &FileStat) != 0 || FileStat.st_size < (off_t)sizeof(IndexHeader))
+        {
+            close(Fd);
+            return;
+        }
+
+        size_t IndexSize = FileStat.st_size;
+        void *Mapping = mmap(NULL, IndexSize, PROT_READ, MAP_PRIVATE, Fd, 0);
+        close(Fd);
+        if (Mapping == MAP_FAILED) return;
+
+        const uint8_t *Data = (const uint8_t *)Mapping;
+        const IndexHeader *Header = (const IndexHeader *)Data;
+        const IndexEntry *Entries = (const IndexEntry *)(Data + sizeof(IndexHeader));
+
+        if (memcmp(Header->Magic, INDEX_MAGIC, 8) != 0 || sizeof(IndexHeader) + (uint64_t)Header->EntryCount * sizeof(IndexEntry) > IndexSize)
+        {
+            munmap(Mapping, IndexSize);
+            return;
+        }
+
+        //Both lists are sorted by path, merge them
+        uint32_t Old = 0;
+        i = 0;
+        while (i < FileNum && Old < Header->EntryCount)
+        {
+            const IndexEntry &OldEntry = Entries[Old];
+            if ((uint64_t)OldEntry.PathOfs + OldEntry.PathLeng > IndexSize)
+            {
+                Old ++;
+                continue;
+            }
+
+            const char *OldPath = (const char *)Data + OldEntry.PathOfs;
+            const char *NewPath = Files[i].RelPath;
+            size_t NewLeng = strlen(NewPath);
+
+            int Cmp = strncmp(OldPath, NewPath, OldEntry.PathLeng);
+            if (Cmp == 0 && NewLeng != OldEntry.PathLeng) Cmp = -1;
+
+            if (Cmp < 0)
+                Old ++;
+            else if (Cmp > 0)
+                i ++;
+            else
+            {
+                IndexEntry &Entry = Files[i].Entry;
+                if (OldEntry.FileSize == Entry.FileSize && OldEntry.MTime == Entry.MTime)
+                {
+                    Entry = OldEntry;
+                    NeedProbe[i] = false;
+                }
+                Old ++;
+                i ++;
+            }
+        }
+
+        munmap(Mapping, IndexSize);
+    }
+
+    static bool WriteIndex(const char *IndexPath)
+    {
+        size_t TmpLeng = strlen(IndexPath) + 5;
+        char *TmpPath = (char *)malloc(TmpLeng);
+        if (TmpPath == NULL) return false;
+        snprintf(TmpPath, TmpLeng, "%s.tmp", IndexPath);
+
+        FILE *File = fopen(TmpPath, "wb");
+        if (File == NULL)
+        {
+            free(TmpPath);
+            return false;
+        }
+
+        IndexHeader Header;
+        memcpy(Header.Magic, INDEX_MAGIC, 8);
+        Header.EntryCount = FileNum;
+        Header.StringOfs = sizeof(IndexHeader) + FileNum * sizeof(IndexEntry);
+
+        bool Result = fwrite(&Header, sizeof(IndexHeader), 1, File) == 1;
+
+        uint32_t PathOfs = Header.StringOfs;
+        int32_t i = 0;
+        while (Result && i < FileNum)
+        {
+            IndexEntry &Entry = Files[i].Entry;
+            Entry.PathOfs = PathOfs;
+            Entry.PathLeng = strlen(Files[i].RelPath);
+            PathOfs += Entry.PathLeng;
+
+            Result = fwrite(&Entry, sizeof(IndexEntry), 1, File) == 1;
+            i ++;
+        }
+
+        i = 0;
+        while (Result && i < FileNum)
+        {
+            Result = fwrite(Files[i].RelPath, 1, Files[i].Entry.PathLeng, File) == Files[i].Entry.PathLeng;
+            i ++;
+        }
+
+        if (fclose(File) != 0) Result = false;
+
+        //Replace the old index only once the new one is complete
+        if (Result) Result = rename(TmpPath, IndexPath) == 0;
+        if (!Result) unlink(TmpPath);
+
+        free(TmpPath);
+        return Result;
+    }
+
+    static void CleanUp()
+    {
+        int32_t i = 0;
+        while (i < FileNum)
+            free(Files[i++].Path);
+
+        free(Files);
+        Files = NULL;
+        FileNum = FileCap = 0;
+
+        delete[] Slices;
+        Slices = NULL;
+        SliceNum = 0;
+    }
+
+    bool BuildIndex(const char *Dir, const char *IndexPath, int Threads)
+    {
+        timespec StartTime, EndTime;
+        clock_gettime(CLOCK_MONOTONIC, &StartTime);
+
+        //Dir and Dir/ (or Dir//) are the same index, entries are stored relative to Dir
+        if (Dir[0] == '\0') Dir = ".";
+        size_t DirLeng = strlen(Dir);
+        while (DirLeng > 1 && Dir[DirLeng - 1] == '/') DirLeng --;
+
+        char *Root = strndup(Dir, DirLeng);
+        if (Root == NULL) return false;
+        RelOfs = DirLeng + (Root[DirLeng - 1] == '/' ? 0 : 1);
+
+        char *DefaultPath = NULL;
+        if (IndexPath == NULL)
+        {
+            size_t Leng = RelOfs + sizeof(INDEX_FILE_NAME);
+            DefaultPath = (char *)malloc(Leng);
+            if (DefaultPath == NULL)
+            {
+                free(Root);
+                return false;
+            }
+            snprintf(DefaultPath, Leng, "%s%s%s", Root, Root[DirLeng - 1] == '/' ? "" : "/", INDEX_FILE_NAME);
+            IndexPath = DefaultPath;
+        }
+
+        FileNum = 0;
+        ProbedNum = 0;
+
+        bool Result = WalkDir(Root);
+        bool *NeedProbe = NULL;
+
+        if (Result)
+        {
+            qsort(Files, FileNum, sizeof(FileItem), ComparePath);
+
+            NeedProbe = (bool *)malloc(FileNum + 1);
+            Result = NeedProbe != NULL;
+        }
+
+        if (Result)
+        {
+            ReuseOldIndex(IndexPath, NeedProbe);
+
+            if (Threads <= 0) Threads = std::thread::hardware_concurrency();
+            if (Threads > INDEXER_THREADS_MAX) Threads = INDEXER_THREADS_MAX;
+            if (Threads < 1) Threads = 1;
+
+            //Split the list evenly, stealing evens out slices with many changed or large files
+            SliceNum = Threads;
+            Slices = new WorkSlice[SliceNum];
+            int i = 0;
+            while (i < SliceNum)
+            {
+                Slices[i].Next = (int32_t)((int64_t)FileNum * i / SliceNum);
+                Slices[i].End = (int32_t)((int64_t)FileNum * (i + 1) / SliceNum);
+                i ++;
+            }
+
+            std::thread Workers[INDEXER_THREADS_MAX];
+            int Started = 0;
+            while (Started < Threads - 1)
+            {
+                try
+                {
+                    Workers[Started] = std::thread(IndexWorker, Started + 1, NeedProbe);
+                }
+                catch (...)
+                {
+                    break;
+                }
+                Started ++;
+            }
+
+            IndexWorker(0, NeedProbe);
+
+            i = 0;
+            while (i < Started)
+                Workers[i++].join();
+
+            Result = WriteIndex(IndexPath);
+        }
+
+        int32_t InvalidNum = 0;
+        int32_t i = 0;
+        while (i < FileNum)
+        {
+            if (!Files[i].Entry.Valid) InvalidNum ++;
+            i ++;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &EndTime);
+        double Elapsed = (EndTime.tv_sec - StartTime.tv_sec) + (EndTime.tv_nsec - StartTime.tv_nsec) / 1e9;
+
+        if (Result)
+            printf("Indexed %d files (%d probed, %d unchanged, %d invalid) in %.2fs\n", FileNum, (int)ProbedNum, FileNum - (int)ProbedNum, InvalidNum, Elapsed);
+        else
+            printf("Failed to write index %s\n", IndexPath);
+
+        if (NeedProbe != NULL) free(NeedProbe);
+        if (DefaultPath != NULL) free(DefaultPath);
+        free(Root);
+        CleanUp();
+
+        return Result;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef LIBGXMINDEXER_H_INCLUDED
+#define LIBGXMINDEXER_H_INCLUDED
+
+#include <stdint.h>
+
+//Index file layout (little endian, can be mapped and used in place):
+//    IndexHeader
+//    IndexEntry[EntryCount]     sorted by path
+//    path strings               not null terminated, see PathOfs/PathLeng, relative to the indexed directory
+
+namespace GXMIndexer
+{
+    static const char INDEX_MAGIC[8] = {'G', 'X', 'M', 'I', 'D', 'X', '0', '3'};
+    static const char INDEX_FILE_NAME[] = ".gxmindex";
+
+    struct IndexHeader
+    {
+        char Magic[8];
+        uint32_t EntryCount;
+        uint32_t StringOfs;
+    };
+
+    struct IndexEntry
+    {
+        uint64_t FileSize;
+        int64_t MTime;              //Nanoseconds
+        uint64_t Hash;              //Hash of the whole file
+        uint32_t PathOfs;           //From the start of the index file
+        uint32_t SampleBytes;
+        uint16_t PathLeng;
+        int16_t Channels;
+        int16_t Orders;
+        uint8_t Valid;              //0 if the file could not be probed
+        uint8_t Reserved;
+        char SongName[24];
+    };
+
+    //Walks Dir and writes the index to IndexPath (Dir/.gxmindex by default), Threads = 0 uses all cores
+    bool BuildIndex(const char *Dir, const char *IndexPath = 0, int Threads = 0);
+}
+
+#endif
@@ -1,6 +1,32 @@
 //Glacc XM Module Player
 //Glacc 2024-07-13
 //
+//      2026-10-17  Added LoadModuleFromFile() (memory-mapped, no intermediate copy)
+//                  Added streaming loader (BeginModuleStream(), FeedModuleStream(), LoadModuleFromFd())
+//                  A streamed module can play once its patterns are in, instruments and samples join as they arrive
+//                  Patterns and samples are unpacked on multiple threads in LoadModule()
+//                  SSE2 delta decoding and bidi loop unrolling
+//                  Added ProbeModule() and ProbeModuleFromFile()
+//                  Added LoadModuleCached() (pre-decoded module cache) and HashModule()
+//                  LoadModule() allocates all module data from one reusable arena
+//                  Added SetLazyDecoding() (decode samples in the background, in order of first use)
+//                  Module headers are validated at load, the mixer no longer range checks samples
+//                  Samples are stored with guard frames, interpolation no longer checks the sample edges
+//                  Added SetSampleFormat() (every sample widened to int16 or float32)
+//                  Added SetCompressSamples() (samples kept in compressed blocks, decoded by the mixer)
+//                  Added SetCompactPatterns() (patterns kept packed, rows unpacked as they are played)
+//                  Rows are compiled to lists of non-empty cells, the sequencer skips empty ones
+//                  Added SetPruneUnused() (patterns and samples that can't be played are not stored)
+//                  Identical patterns and samples in a module are stored once
+//                  Added GetMemoryStats() (bytes held by the loaded module and the most held while loading)
+//                  Linear period to delta, vibrato/tremolo sine and pan law are looked up in tables
+//                  Amiga periods are looked up in a note and fine tune table built when an Amiga module is loaded
+//                  Volume and pan envelopes are rasterised per instrument at load, playback looks them up
+//                  Channels only work out the delta, ramp targets and sample loop again when they change
+//                  Added GetUpdateStats() (how many of those were skipped)
+//                  Playback reads instruments from a compact per-tick copy and no longer copies instruments and samples
+//                  Added SetUnrollBidiLoops() (bidi loops can play without an unrolled copy)
+//
 //      2024-07-13  Updated coding style
 //                  Added SFML/Audio support
 //
@@ -64,6 +90,22 @@
 #include <math.h>
 #include <algorithm>
 #include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <thread>
+#include <atomic>
+#include <new>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #ifdef _SDL2
 #include <SDL2/SDL.h>
@@ -88,9 +130,33 @@
 #define INT_ACC_INTERPOL 15
 #define INT_MASK 0xFFFF
 
+#define LOAD_THREADS_MAX 16
+#define PARALLEL_LOAD_MIN 262144
+
+#define CACHE_VERSION 7
+#define CACHE_ALIGN 4096
+#define ARENA_ALIGN 64
+
+#define CHANNELS_MAX 128
+#define INSTRUMENTS_MAX 254
+#define INST_SAMPLES_MAX 16
+#define SAMPLE_BYTES_MAX 0x3FFFFFFE
+#define GUARD_FRAMES 4
+#define BLOCK_FRAMES 128
+#define BLOCK_RAW 0x80
+
 #define NOTE_SIZE_XM 5
 #define ROW_SIZE_XM NOTE_SIZE_XM * numOfChannels
 
+#define PERIOD_TAB_MIN 50
+#define PERIOD_TAB_SIZE 8192
+
+//What UpdateChannelInfo() works out again for a channel, see Channel::dirty
+#define CH_DIRTY_PERIOD 0x01    //Period or what moves it, the delta
+#define CH_DIRTY_VOLUME 0x02    //Volume, pan, envelope value or fade, the ramp targets and speeds
+#define CH_DIRTY_SAMPLE 0x04    //Playing sample, its length and loop
+#define CH_DIRTY_ALL 0x07
+
 namespace GXMPlayer
 {
 #ifdef _SDL2
@@ -110,6 +176,11 @@ namespace GXMPlayer
 	static double amplifier = 1;
 	static bool ignoreF00 = false;
 	static int8_t panMode = 0;
+	static bool unrollBidiLoops = true;
+	static int8_t widenFormat = 0;
+	static bool compressSamples = false;
+	static bool compactPatterns = false;
+	static bool pruneUnused = false;
 
 	static int bufferSize;
 	static int sampleRate;
@@ -118,6 +189,12 @@ namespace GXMPlayer
 	static uint8_t masterVolume;
 
 	static bool useAmigaFreqTable;
+	static bool bidiUnrolled;      //How the loaded module's bidi loops are stored, see SetUnrollBidiLoops()
+	static int8_t sampleFormat;    //How the loaded module's samples are stored, see SetSampleFormat()
+	static bool samplesCompressed; //See SetCompressSamples()
+	static bool patternsCompact;   //See SetCompactPatterns()
+	static bool unusedPruned;      //See SetPruneUnused()
+	static int32_t prunedSize;     //Pattern and sample bytes the loaded module didn't store
 	static int16_t numOfChannels;
 	static int16_t numOfPatterns;
 	static int16_t numOfInstruments;
@@ -128,11 +205,12 @@ namespace GXMPlayer
 	static int16_t defaultTempo;
 	static int16_t defaultSpd;
 
-	static uint8_t *songData;
+	static const uint8_t *songData;
 	static uint8_t *patternData;
 	static int8_t *sampleData;
 	//static int16_t *sndBuffer[2];
 
+	//Instrument as loaded, the tick path reads its HotInstrument instead
 	struct Instrument
 	{
 		int16_t sampleNum;
@@ -163,6 +241,7 @@ namespace GXMPlayer
 		int32_t loopStart;
 		int32_t loopLength;
 		int8_t *data;
+		int32_t firstBlock;
 		int8_t volume;
 		int8_t fineTune;
 		int8_t type;
@@ -181,7 +260,19 @@ namespace GXMPlayer
 	static Instrument *instruments;
 	static Sample *samples;
 	static int16_t *sampleStartIndex;
-	static int32_t *sampleHeaderAddr;
+
+	static void *moduleMapping;
+	static size_t moduleMappingSize;
+
+	//Module data of LoadModule() lives in one arena, kept and reused by later loads
+	static uint8_t *moduleArena;
+	static uint8_t *moduleArenaBase;
+	static size_t moduleArenaSize;
+	static bool moduleInArena;
+
+	//Bytes held while a module loads, the source module included, and the most of them at once
+	static size_t loadBytes;
+	static size_t loadPeak;
 
 	static int16_t tick, curRow, curPos;
 	static int16_t patBreak, patJump, patDelay;
@@ -227,6 +318,82 @@ namespace GXMPlayer
 		0,  1,  2,  4,  8,  16,  0,  0
 	};
 
+	//Filled with the math UpdateChannelInfo() did every tick, so the values are the same
+	//The sine and pan law tables are built once by InitTables(), the delta table by InitDeltaTable()
+	//whenever a load sets a new sample rate, never on the mixing path
+	static double sineTab[64];      //sin(pos * PI / 32), vibrato and tremolo
+	static double panLawTab[257];   //sqrt(pan / 256.0), FT2 square root panning law
+	static uint32_t linearDeltaTab[PERIOD_TAB_SIZE]; //Delta of linear period PERIOD_TAB_MIN + n at tableRate, 0 if it doesn't fit
+	static int tableRate;
+	static bool tablesReady;
+
+	//Amiga period of octave 5 for each note in an octave and fine tune, built by InitAmigaTable()
+	//Other octaves are the octave 5 period shifted, the exact power of two CalcPeriod() multiplied by
+	static int16_t amigaPeriodTab[12 * 256];
+	static bool amigaTableReady;
+
+	static void InitAmigaTable()
+	{
+		if (amigaTableReady) return;
+
+		int16_t note = 0;
+		while (note < 12)
+		{
+			int16_t fineTune = -128;
+			while (fineTune < 128)
+			{
+				//https://github.com/dodocloud/xmplayer/blob/master/src/xmlib/engine/utils.ts
+				//function calcPeriod
+				double fineTuneFrac = floor((double)fineTune / 16.0);
+				uint16_t period1 = periodTab[8 + note * 8 + (int16_t)fineTuneFrac];
+				uint16_t period2 = periodTab[8 + note * 8 + (int16_t)fineTuneFrac + 1];
+				fineTuneFrac = ((double)fineTune / 16.0) - fineTuneFrac;
+				amigaPeriodTab[note * 256 + fineTune + 128] = (int16_t)round((1.0 - fineTuneFrac) * period1 + fineTuneFrac * period2);
+				fineTune ++;
+			}
+			note ++;
+		}
+
+		amigaTableReady = true;
+	}
+
+#define PI 3.1415926535897932384626433832795
+
+	static void InitTables()
+	{
+		if (tablesReady) return;
+
+		int32_t i = 0;
+		while (i < 64)
+		{
+			sineTab[i] = sin(i * PI / 32);
+			i ++;
+		}
+
+		i = 0;
+		while (i <= 256)
+		{
+			panLawTab[i] = sqrt(i / 256.0);
+			i ++;
+		}
+
+		tablesReady = true;
+	}
+
+	static void InitDeltaTable()
+	{
+		int32_t i = 0;
+		while (i < PERIOD_TAB_SIZE)
+		{
+			double realPeriod = PERIOD_TAB_MIN + i;
+			double delta = 8363 * pow(2, (4608 - realPeriod) / 768) / sampleRate * TOINT_SCL;
+			linearDeltaTab[i] = delta < 4294967296.0 ? (uint32_t)delta : 0;
+			i ++;
+		}
+
+		tableRate = sampleRate;
+	}
+
 	struct Channel
 	{
 		int8_t note;
@@ -286,6 +453,9 @@ namespace GXMPlayer
 		uint8_t autoVibPos;
 		uint8_t autoVibSweep;
 		int8_t envFlags;
+		uint8_t volEnvValue;    //Envelope values of the last tick
+		uint8_t panEnvValue;
+		uint8_t dirty;          //CH_DIRTY_ bits, set by ChkNote(), ChkEffectTick() and envelopes, cleared by UpdateChannelInfo() unless it changed the volume itself
 
 		bool instTrig;
 		bool LxxEffect;
@@ -307,6 +477,8 @@ namespace GXMPlayer
 		int32_t loopStart;
 		int32_t loopEnd;
 		int32_t loopLeng;
+		int32_t reversePos;
+		int32_t mirrorPos;
 		int32_t delta;
 		float facL;
 		float facR;
@@ -327,6 +499,17 @@ namespace GXMPlayer
 		int32_t endSmp;
 	};
 
+	//Decoded block of a compressed sample for each channel, the channel's data points into it (see
+	//LoadSampleBlock()). Only allocated with compressed samples so Channel stays small without them
+	struct VoiceBlock
+	{
+		int16_t sample;
+		int32_t first;
+		int16_t data[BLOCK_FRAMES + 1];
+	};
+
+	static VoiceBlock *voiceBlocks;
+
 	struct Note
 	{
 		uint8_t note;
@@ -336,12 +519,117 @@ namespace GXMPlayer
 		uint8_t parameter;
 	};
 
+	//Last row unpacked from a compact pattern, see PatternRow()
+	struct RowCache
+	{
+		int16_t pattern;
+		int16_t row;
+		Note notes[CHANNELS_MAX];
+	};
+
+	static RowCache viewRow; //GetNotePat()
+
+	//Non-empty cell of a row, see CompileEvents()
+	struct CellEvent
+	{
+		Note note;
+		uint8_t channel;
+		bool tickEffect; //ChkEffectTick() does more than for an empty cell
+	};
+
+	//Cells of row r of pattern p are cellEvents[rowEvents[patternRowBase[p] + r]] up to the next row's first,
+	//every pattern has one more entry than rows and the last one ends the table
+	static CellEvent *cellEvents;
+	static int32_t *rowEvents;
+	static int32_t patternRowBase[256];
+	static uint32_t eventTableSize; //Bytes of cellEvents and rowEvents
+
+	struct ModuleInfo
+	{
+		char songName[21];
+		char trackerName[21];
+		uint16_t trackerVersion;
+		int16_t songLength;
+		int16_t rstPos;
+		int16_t numOfChannels;
+		int16_t numOfPatterns;
+		int16_t numOfInstruments;
+		int16_t numOfSamples;
+		int16_t defaultSpd;
+		int16_t defaultTempo;
+		bool useAmigaFreqTable;
+		uint8_t orderTable[256];
+		int32_t totalRows;
+		uint32_t patternDataSize;
+		uint32_t sampleDataSize;
+		uint32_t decodedSampleSize;
+		uint32_t int16SampleSize;
+		uint32_t floatSampleSize;
+	};
+
+	struct MemoryStats
+	{
+		uint32_t patternDataSize;
+		uint32_t sampleDataSize;
+		uint32_t instrumentSize;
+		uint32_t sampleSize;
+		uint32_t channelSize;
+		uint32_t eventSize;
+		uint32_t hotInstrumentSize;
+		uint32_t sourceSize;
+		uint32_t audioBufferSize;
+		uint64_t totalSize;
+		uint64_t loadPeakSize;
+	};
+
+	struct UpdateStats
+	{
+		uint64_t channelTicks;
+		uint64_t periodSkipped;
+		uint64_t volumeSkipped;
+		uint64_t sampleSkipped;
+	};
+
+	//Counted by UpdateChannelInfo() since the module was loaded or reset
+	static UpdateStats updateStats;
+	static bool channelsDirty;      //Every channel is worked out again on the next tick
+	static uint8_t updateGlobalVol; //globalVol the ramp targets were worked out with
+
 	struct EnvInfo
 	{
 		uint8_t value;
 		int16_t maxPoint;
 	};
 
+	//Envelope of an instrument rasterised at load by RasteriseEnvelope(), positions are in ticks
+	struct EnvTrack
+	{
+		uint8_t *values;    //Value at every position up to end, NULL if the envelope is off, ends before 0 or is too long
+		int16_t end;        //Position of the last point
+		int16_t sustain;
+		int16_t loopStart;
+		int16_t loopEnd;
+	};
+
+	//What UpdateChannelInfo() reads of an instrument every tick, built at load by BuildHotInstruments()
+	//Kept apart from the name, sample map and envelope points, so every instrument fits in a few cache lines
+	struct HotInstrument
+	{
+		EnvTrack volEnv;
+		EnvTrack panEnv;
+		int16_t fadeOut;
+		int8_t volType;
+		int8_t panType;
+		int8_t vibratoType;
+		int8_t vibratoSweep;
+		int8_t vibratoDepth;
+		int8_t vibratoRate;
+	};
+
+	static HotInstrument *hotInstruments;
+	static uint32_t hotInstSize;    //Bytes of hotInstruments and the envelope values
+	static std::atomic<int16_t> hotInstReady;   //Instruments playback can use, a streamed module adds them as they arrive
+
 	static Channel *channels;
 
 #define Ch channels[i]
@@ -374,6 +662,7 @@ namespace GXMPlayer
 			Ch.loop = 0;
 
 			Ch.samplePlaying = -1;
+			if (voiceBlocks != NULL) voiceBlocks[i].sample = -1;
 			Ch.sample = -1;
 			Ch.instrument = 0;
 			Ch.nextInstrument = 0;
@@ -435,6 +724,9 @@ namespace GXMPlayer
 			Ch.volEnvelope = 0;
 			Ch.panEnvelope = 0;
 			Ch.envFlags = 0;
+			Ch.volEnvValue = 0;
+			Ch.panEnvValue = 0;
+			Ch.dirty = CH_DIRTY_ALL;
 
 			Ch.instTrig = false;
 			Ch.active = false;
@@ -523,12 +815,15 @@ namespace GXMPlayer
 
 		RecalcAmp();
 
+		if (useAmigaFreqTable) InitAmigaTable();
+		memset(&updateStats, 0, sizeof(UpdateStats));
+
 		ResetChannels();
 
 		UpdateTimer();
 	}
 
-	bool LoadModule(uint8_t *songDataOrig, uint32_t songDataLeng, bool useInterpolation = true, bool stereoEnabled = true, bool loopSong = true, int bufSize = BUFFER_SIZE, int smpRate = SMP_RATE)
+	static void InitSettings(bool useInterpolation, bool stereoEnabled, bool loopSong, int bufSize, int smpRate)
 	{
 		loop = loopSong;
 		stereo = stereoEnabled;
@@ -542,414 +837,3204 @@ namespace GXMPlayer
 
 		timePerSample = 1.0 / sampleRate;
 
-		masterVolume = 255;
-
-		int i, j, k;
-		int32_t songDataOfs = 17;
+		InitTables();
+		if (tableRate != sampleRate)
+		{
+			InitDeltaTable();
+			channelsDirty = true;
+		}
 
-		//Song data init
-		if (songData != NULL) free(songData);
-		songData = (uint8_t *)malloc(songDataLeng);
-		if (songData == NULL) return false;
+		masterVolume = 255;
+	}
 
-		memcpy(songData, songDataOrig, songDataLeng);
+	//Parses the fixed header and the order table, returns the offset of the first pattern
+	static int32_t ParseSongHeader(const uint8_t *data, uint32_t dataLeng)
+	{
+		int i;
+		int32_t dataOfs = 17;
 
 		//Song name
 		i = 0;
 		while (i < 20)
-			songName[i++] = songData[songDataOfs++];
+			songName[i++] = data[dataOfs++];
 
 		//Tracker name & version
-		songDataOfs = 38;
+		dataOfs = 38;
 		i = 0;
 		while (i < 20)
-			trackerName[i++] = songData[songDataOfs++];
+			trackerName[i++] = data[dataOfs++];
 
-		trackerVersion = (((((uint16_t)songData[songDataOfs]) << 8) & 0xFF00) | songData[songDataOfs + 1]);
+		trackerVersion = (((((uint16_t)data[dataOfs]) << 8) & 0xFF00) | data[dataOfs + 1]);
 
-		songDataOfs = 60;
+		dataOfs = 60;
 
 		//Song settings
-		int32_t HeaderSize = *(int32_t *)(songData + songDataOfs) + 60;
-		songLength = *(int16_t *)(songData + songDataOfs + 4);
-		rstPos = *(int16_t *)(songData + songDataOfs + 6);
-		numOfChannels = *(int16_t *)(songData + songDataOfs + 8);
-		numOfPatterns = *(int16_t *)(songData + songDataOfs + 10);
-		numOfInstruments = *(int16_t *)(songData + songDataOfs + 12);
-		useAmigaFreqTable = !(songData[songDataOfs + 14] & 1);
-
-		defaultSpd = *(int16_t *)(songData + songDataOfs + 16);
-		defaultTempo = *(int16_t *)(songData + songDataOfs + 18);
-
-		if (channels != NULL) free(channels);
-		channels = (Channel *)malloc(sizeof(Channel) * numOfChannels);
-		if (channels == NULL) return false;
-
-		//Pattern order table
-		songDataOfs = 80;
+		int32_t headerSize = *(int32_t *)(data + dataOfs) + 60;
+		songLength = *(int16_t *)(data + dataOfs + 4);
+		rstPos = *(int16_t *)(data + dataOfs + 6);
+		numOfChannels = *(int16_t *)(data + dataOfs + 8);
+		numOfPatterns = *(int16_t *)(data + dataOfs + 10);
+		numOfInstruments = *(int16_t *)(data + dataOfs + 12);
+		useAmigaFreqTable = !(data[dataOfs + 14] & 1);
+
+		defaultSpd = *(int16_t *)(data + dataOfs + 16);
+		defaultTempo = *(int16_t *)(data + dataOfs + 18);
+
+		//Playback indexes orderTable[curPos] and orderTable[rstPos] without range checks
+		songLength = MAX(MIN(songLength, 256), 1);
+		if (rstPos < 0 || rstPos >= songLength) rstPos = 0;
+
+		//Pattern order table, orders past the last pattern play pattern 0
+		memset(orderTable, 0, 256);
+		dataOfs = 80;
 		i = 0;
-		while (i < songLength)
-			orderTable[i++] = songData[songDataOfs++];
+		while (i < songLength && (uint32_t)dataOfs < dataLeng)
+		{
+			uint8_t order = data[dataOfs++];
+			orderTable[i++] = order < numOfPatterns ? order : 0;
+		}
 
-		//Pattern data size calc
-		memset(patternAddr, 0, 256 * 4);
-		totalPatSize = 0;
+		return headerSize;
+	}
 
-		songDataOfs = HeaderSize;
-		int32_t patternOrig = songDataOfs;
-		i = 0;
-		while (i < numOfPatterns)
-		{
-			int32_t patHeaderSize = *(int32_t *)(songData + songDataOfs);
-			int16_t patternLeng = *(int16_t *)(songData + songDataOfs + 5);
-			int16_t patternSize = *(int16_t *)(songData + songDataOfs + 7);
+	//Song settings the engine relies on, checked after ParseSongHeader()
+	static bool ValidSongHeader()
+	{
+		return numOfChannels > 0 && numOfChannels <= CHANNELS_MAX
+			&& numOfPatterns > 0 && numOfPatterns <= 256
+			&& numOfInstruments >= 0;
+	}
 
-			patternAddr[i++] = totalPatSize;
+	//Rows from a pattern header, 0 is read as 64, -1 if out of range
+	static int16_t PatternRows(const uint8_t *patHeader)
+	{
+		int16_t patternLeng = *(int16_t *)(patHeader + 5);
+		if (patternLeng == 0) return 64;
 
-			songDataOfs += patHeaderSize + patternSize;
+		return patternLeng > 0 && patternLeng <= 256 ? patternLeng : -1;
+	}
 
-			totalPatSize += 2 + patternLeng * ROW_SIZE_XM;
-		}
+	//Unpacks the note at src[srcOfs] into 5 bytes at dst, returns the offset of the next note
+	//A note cut off by the end of the packed data is dropped and -1 returned
+	static int32_t UnpackNote(const uint8_t *src, int32_t srcLeng, int32_t srcOfs, uint8_t *dst)
+	{
+		int8_t signByte = src[srcOfs++];
 
-		//Pattern data init
-		if (patternData != NULL) free(patternData);
-		patternData = (uint8_t *)malloc(totalPatSize);
-		if (patternData == NULL) return false;
-		memset(patternData, 0, totalPatSize);
+		int32_t noteBytes = 4;
+		if (signByte & 0x80)
+			noteBytes = (signByte & 0x01) + ((signByte >> 1) & 0x01) + ((signByte >> 2) & 0x01) + ((signByte >> 3) & 0x01) + ((signByte >> 4) & 0x01);
+		if (srcOfs + noteBytes > srcLeng) return -1;
 
-		//Patter data
-		songDataOfs = patternOrig;
-		i = 0;
-		while (i < numOfPatterns)
+		memset(dst, 0, NOTE_SIZE_XM);
+
+		if (signByte & 0x80)
 		{
-			int32_t patHeaderSize = *(int32_t *)(songData + songDataOfs);
-			int16_t patternLeng = *(int16_t *)(songData + songDataOfs + 5);
-			int16_t patternSize = *(int16_t *)(songData + songDataOfs + 7);
+			if (signByte & 0x01) dst[0] = src[srcOfs++];
+			if (signByte & 0x02) dst[1] = src[srcOfs++];
+			if (signByte & 0x04) dst[2] = src[srcOfs++];
+			if (signByte & 0x08) dst[3] = src[srcOfs++];
+			if (signByte & 0x10) dst[4] = src[srcOfs++];
+		}
+		else
+		{
+			dst[0] = signByte;
+			dst[1] = src[srcOfs++];
+			dst[2] = src[srcOfs++];
+			dst[3] = src[srcOfs++];
+			dst[4] = src[srcOfs++];
+		}
 
-			int32_t PDIndex = patternAddr[i];
-			patternData[PDIndex++] = patternLeng & 0xFF;
-			patternData[PDIndex++] = (int8_t)((patternLeng >> 8) & 0xFF);
+		//Notes past key off are empty, so playback can index tables by note
+		if (dst[0] > 97) dst[0] = 0;
 
-			songDataOfs += patHeaderSize;
+		return srcOfs;
+	}
 
-			if (patternSize > 0)
-			{
-				j = 0;
-				while (j < patternLeng)
-				{
-					k = 0;
-					while (k < numOfChannels)
-					{
-						int8_t SignByte = songData[songDataOfs++];
+	//Unpacks one pattern into 5 bytes per note, srcLeng is the packed size from the pattern header
+	static void UnpackPattern(const uint8_t *src, int32_t srcLeng, uint8_t *dst, int16_t patternLeng)
+	{
+		int32_t srcOfs = 0;
+		int32_t dstOfs = 0;
+		int32_t dstLeng = patternLeng * ROW_SIZE_XM;
 
-						patternData[PDIndex] = 0;
-						patternData[PDIndex + 1] = 0;
+		while (dstOfs < dstLeng && srcOfs < srcLeng)
+		{
+			srcOfs = UnpackNote(src, srcLeng, srcOfs, dst + dstOfs);
+			if (srcOfs < 0) break;
 
-						if (SignByte & 0x80)
-						{
-							if (SignByte & 0x01) patternData[PDIndex] = songData[songDataOfs++];
-							if (SignByte & 0x02) patternData[PDIndex + 1] = songData[songDataOfs++];
-							if (SignByte & 0x04) patternData[PDIndex + 2] = songData[songDataOfs++];
-							if (SignByte & 0x08) patternData[PDIndex + 3] = songData[songDataOfs++];
-							if (SignByte & 0x10) patternData[PDIndex + 4] = songData[songDataOfs++];
-						}
-						else
-						{
-							patternData[PDIndex] = SignByte;
-							patternData[PDIndex + 1] = songData[songDataOfs++];
-							patternData[PDIndex + 2] = songData[songDataOfs++];
-							patternData[PDIndex + 3] = songData[songDataOfs++];
-							patternData[PDIndex + 4] = songData[songDataOfs++];
-						}
-						PDIndex += 5;
-						k ++;
-					}
-					j ++;
-				}
-			}
-			i ++;
+			dstOfs += NOTE_SIZE_XM;
 		}
+	}
 
-		//instrument size calc
-		if (sampleStartIndex != NULL) free(sampleStartIndex);
-		sampleStartIndex = (int16_t *)malloc(numOfInstruments * 2);
-		if (sampleStartIndex == NULL) return false;
-
-		if (instruments != NULL) free(instruments);
-		instruments = (Instrument *)malloc(numOfInstruments * sizeof(Instrument));
-		if (instruments == NULL) return false;
-
-		totalInstSize = totalSampleSize = totalSampleNum = 0;
-		int instOrig = songDataOfs;
-		i = 0;
-		while (i < numOfInstruments)
+	//Compact pattern (see SetCompactPatterns()) after its row count: the packed size, the offset of
+	//every row in the packed notes and the packed notes themselves
+	static void IndexPattern(const uint8_t *src, int32_t srcLeng, uint8_t *dst, int16_t patternLeng)
+	{
+		uint16_t *rowOfs = (uint16_t *)(dst + 2);
+		*(uint16_t *)dst = srcLeng;
+		memcpy(dst + 2 + patternLeng * 2, src, srcLeng);
+
+		uint8_t note[NOTE_SIZE_XM];
+		int32_t srcOfs = 0;
+		int16_t row = 0;
+		while (row < patternLeng)
 		{
-			int32_t instSize = *(int32_t *)(songData + songDataOfs);
-			int16_t instSampleNum = *(int16_t *)(songData + songDataOfs + 27);
-			instruments[i].sampleNum = instSampleNum;
+			rowOfs[row++] = srcOfs;
 
-			//name
-			k = 0;
-			while (k < 22)
+			int16_t col = 0;
+			while (col < numOfChannels && srcOfs < srcLeng)
 			{
-				instruments[i].name[k] = songData[songDataOfs + 4 + k];
-				k ++;
+				srcOfs = UnpackNote(src, srcLeng, srcOfs, note);
+				if (srcOfs < 0) srcOfs = srcLeng;
+				col ++;
 			}
+		}
+	}
 
-			if (instSampleNum > 0)
-			{
-				//note mapping
-				j = 0;
-				while (j < 96)
-				{
-					instruments[i].sampleMap[j] = totalSampleNum + songData[songDataOfs + 33 + j];
-					j ++;
-				}
+	//Bytes a pattern takes in patternData, including its row count
+	static int32_t PatternStorageSize(int16_t patternLeng, int32_t patternSize)
+	{
+		if (patternsCompact) return 4 + patternLeng * 2 + patternSize;
 
-				//Vol envelopes
-				j = 0;
-				while (j < 24)
-				{
-					instruments[i].volEnvelops[j] = *(int16_t *)(songData + songDataOfs + 129 + j * 2);
-					j ++;
-				}
+		return 2 + patternLeng * ROW_SIZE_XM;
+	}
 
-				//pan envelopes
-				j = 0;
-				while (j < 24)
-				{
-					instruments[i].panEnvelops[j] = *(int16_t *)(songData + songDataOfs + 177 + j * 2);
-					j ++;
-				}
+	//Notes of one row, compact patterns are unpacked into cache unless it already holds the row
+	static const Note *PatternRow(uint8_t pattern, int16_t row, RowCache &cache)
+	{
+		const uint8_t *pat = patternData + patternAddr[pattern];
+		if (!patternsCompact) return (const Note *)(pat + 2 + ROW_SIZE_XM * row);
 
-				instruments[i].volPoints = songData[songDataOfs + 225];
-				instruments[i].panPoints = songData[songDataOfs + 226];
-				instruments[i].volSustainPt = songData[songDataOfs + 227];
-				instruments[i].volLoopStart = songData[songDataOfs + 228];
-				instruments[i].volLoopEnd = songData[songDataOfs + 229];
-				instruments[i].panSustainPt = songData[songDataOfs + 230];
-				instruments[i].panLoopStart = songData[songDataOfs + 231];
-				instruments[i].panLoopEnd = songData[songDataOfs + 232];
-				instruments[i].volType = songData[songDataOfs + 233];
-				instruments[i].panType = songData[songDataOfs + 234];
-				instruments[i].vibratoType = songData[songDataOfs + 235];
-				instruments[i].vibratoSweep = songData[songDataOfs + 236];
-				instruments[i].vibratoDepth = songData[songDataOfs + 237];
-				instruments[i].vibratoRate = songData[songDataOfs + 238];
-				instruments[i].fadeOut = *(int16_t *)(songData + songDataOfs + 239);
-
-				songDataOfs += instSize;
-
-				int32_t subOfs = 0;
-				int32_t sampleDataOfs = 0;
-				j = 0;
-				while (j < instSampleNum)
-				{
-					subOfs = j * 40;
-					int32_t sampleLeng = *(int32_t *)(songData + songDataOfs + subOfs);
-					int32_t loopStart = *(int32_t *)(songData + songDataOfs + subOfs + 4);
-					int32_t loopLeng = *(int32_t *)(songData + songDataOfs + subOfs + 8);
-					int8_t sampleType = songData[songDataOfs + subOfs + 14] & 0x03;
+		if (cache.pattern != pattern || cache.row != row)
+		{
+			int16_t patternLeng = *(int16_t *)pat;
+			int32_t srcLeng = *(uint16_t *)(pat + 2);
+			const uint8_t *src = pat + 4 + patternLeng * 2;
+			int32_t srcOfs = *(uint16_t *)(pat + 4 + row * 2);
+
+			memset(cache.notes, 0, numOfChannels * sizeof(Note));
+			int16_t col = 0;
+			while (col < numOfChannels && srcOfs >= 0 && srcOfs < srcLeng)
+			{
+				srcOfs = UnpackNote(src, srcLeng, srcOfs, (uint8_t *)&cache.notes[col]);
+				col ++;
+			}
 
-					sampleDataOfs += sampleLeng;
+			cache.pattern = pattern;
+			cache.row = row;
+		}
 
-					if (sampleType == 1)
-						sampleLeng = loopStart + loopLeng;
-					if ((songData[songDataOfs + subOfs + 14] & 0x03) >= 2)
-						sampleLeng = loopStart + (loopLeng + loopLeng);
+		return cache.notes;
+	}
 
-					totalSampleSize += sampleLeng;
-					j ++;
-				}
-				songDataOfs += instSampleNum * 40 + sampleDataOfs;
-			}
-			else songDataOfs += instSize;
+	//Starts counting for a new load, what the load helpers keep from earlier loads is held already
+	static void BeginLoadPeak(size_t held)
+	{
+		loadBytes = loadPeak = held;
+	}
 
-			sampleStartIndex[i] = totalSampleNum;
-			totalSampleNum += instSampleNum;
+	static void LoadHold(size_t bytes)
+	{
+		loadBytes += bytes;
+		if (loadBytes > loadPeak) loadPeak = loadBytes;
+	}
 
-			i ++;
+	static void LoadRelease(size_t bytes)
+	{
+		loadBytes -= MIN(bytes, loadBytes);
+	}
+
+	static bool HasTickEffect(const Note &note)
+	{
+		switch (note.effect)
+		{
+		case 1: case 2: case 3: case 4: case 5: case 6: case 7: case 8:
+		case 10: case 12: case 17: case 20: case 25: case 27: case 29:
+			return true;
+		case 14:
+			if ((note.parameter & 0xF0) == 0x90 || (note.parameter & 0xF0) == 0xC0 || (note.parameter & 0xF0) == 0xD0)
+				return true;
+			break;
+		}
+
+		switch (note.volCmd & 0xF0)
+		{
+		case 0x60: case 0x70: case 0xB0: case 0xD0: case 0xE0: case 0xF0:
+			return true;
 		}
 
-		//sample convert
-		if (sampleHeaderAddr != NULL) free(sampleHeaderAddr);
-		sampleHeaderAddr = (int32_t *)malloc(totalSampleNum * 4);
-		if (sampleHeaderAddr == NULL) return false;
+		return false;
+	}
 
+	//Earlier pattern stored at the same place as patNum, -1 if there is none
+	static int16_t SharedPattern(int16_t patNum)
+	{
+		int16_t k = 0;
+		while (k < patNum)
+		{
+			if (patternAddr[k] == patternAddr[patNum]) return k;
+			k ++;
+		}
 
-		if (sampleData != NULL) free(sampleData);
-		sampleData = (int8_t *)malloc(totalSampleSize);
-		if (sampleData == NULL) return false;
+		return -1;
+	}
 
-		if (samples != NULL) free(samples);
-		samples = (Sample *)malloc(totalSampleNum * sizeof(Sample));
-		if (samples == NULL) return false;
+	//Lists the non-empty cells of every row, NextRow() and NextTick() only look up those
+	static bool CompileEvents()
+	{
+		RowCache scanRow;
+		scanRow.pattern = -1;
 
-		int16_t sampleNum = 0;
-		int32_t sampleWriteOfs = 0;
-		songDataOfs = instOrig;
-		i = 0;
-		while (i < numOfInstruments)
+		int32_t rowNum = 0;
+		int32_t eventNum = 0;
+		int16_t pat = 0;
+		while (pat < numOfPatterns)
 		{
-			int32_t instSize = *(int32_t *)(songData + songDataOfs);
-			int16_t instSampleNum = *(int16_t *)(songData + songDataOfs + 27);
+			//Patterns stored once share their cells too
+			int16_t shared = SharedPattern(pat);
+			if (shared >= 0)
+			{
+				patternRowBase[pat] = patternRowBase[shared];
+				pat ++;
+				continue;
+			}
 
-			songDataOfs += instSize;
+			int16_t patternLeng = *(int16_t *)(patternData + patternAddr[pat]);
+			patternRowBase[pat] = rowNum;
+			rowNum += patternLeng + 1;
 
-			if (instSampleNum > 0)
+			int16_t row = 0;
+			while (row < patternLeng)
 			{
-				int32_t subOfs = 0;
-				int32_t sampleDataOfs = 0;
-				j = 0;
-				while (j < instSampleNum)
+				const Note *notes = PatternRow(pat, row, scanRow);
+				int16_t ch = 0;
+				while (ch < numOfChannels)
 				{
-					sampleNum = sampleStartIndex[i] + j;
-					subOfs = j * 40;
-					sampleHeaderAddr[sampleNum] = songDataOfs + subOfs;
-					int32_t sampleLeng = *(int32_t *)(songData + songDataOfs + subOfs);
-					int32_t loopStart = *(int32_t *)(songData + songDataOfs + subOfs + 4);
-					int32_t loopLeng = *(int32_t *)(songData + songDataOfs + subOfs + 8);
-					int8_t sampleType = songData[songDataOfs + subOfs + 14];
-					bool is16Bit = (sampleType & 0x10);
-
-					int16_t sampleNum = sampleStartIndex[i] + j;
-
-					samples[sampleNum].origInst = i + 1;
-					samples[sampleNum].type = sampleType & 0x03;
-					samples[sampleNum].is16Bit = is16Bit;
-
-					samples[sampleNum].volume = songData[songDataOfs + subOfs + 12];
-					samples[sampleNum].pan = songData[songDataOfs + subOfs + 15];
-					samples[sampleNum].fineTune = *(int8_t *)(songData + songDataOfs + subOfs + 13);
-					samples[sampleNum].relNote = *(int8_t *)(songData + songDataOfs + subOfs + 16);
-
-					k = 0;
-					while (k < 22)
-					{
-						samples[sampleNum].name[k] = songData[songDataOfs + subOfs + 18 + k];
-						k ++;
-					}
+					const Note &note = notes[ch++];
+					if (note.note | note.instrument | note.volCmd | note.effect | note.parameter) eventNum ++;
+				}
+				row ++;
+			}
+			pat ++;
+		}
 
-					samples[sampleNum].data = sampleData + sampleWriteOfs;
-					subOfs = 40 * instSampleNum + sampleDataOfs;
-					sampleDataOfs += sampleLeng;
+		rowEvents = (int32_t *)malloc((rowNum + 1) * sizeof(int32_t));
+		cellEvents = (CellEvent *)malloc(MAX(eventNum, 1) * sizeof(CellEvent));
+		if (rowEvents == NULL || cellEvents == NULL) return false;
 
-					if (is16Bit)
-					{
-						samples[sampleNum].length = sampleLeng >> 1;
-						samples[sampleNum].loopStart = loopStart >> 1;
-						samples[sampleNum].loopLength = loopLeng >> 1;
-					}
-					else
-					{
-						samples[sampleNum].length = sampleLeng;
-						samples[sampleNum].loopStart = loopStart;
-						samples[sampleNum].loopLength = loopLeng;
-					}
+		eventTableSize = (rowNum + 1) * sizeof(int32_t) + MAX(eventNum, 1) * sizeof(CellEvent);
+		LoadHold(eventTableSize);
 
-					int32_t reversePoint = -1;
-					if (samples[sampleNum].type == 1)
-						sampleLeng = loopStart + loopLeng;
-					else if (samples[sampleNum].type >= 2)
-					{
-						reversePoint = loopStart + loopLeng;
-						sampleLeng = reversePoint + loopLeng;
-					}
+		eventNum = 0;
+		pat = 0;
+		while (pat < numOfPatterns)
+		{
+			if (SharedPattern(pat) >= 0)
+			{
+				pat ++;
+				continue;
+			}
 
-					bool reverse = false;
-					int32_t readOfs = 0;
-					int16_t oldPt = 0;
-					k = 0;
-					if (is16Bit)
-					{
-						int16_t newPt;
-						sampleLeng >>= 1;
-						reversePoint >>= 1;
-						while (k < sampleLeng)
-						{
-							//int16_t newPt = (int16_t)SONGSEEK16(songDataOfs + subOfs, songData) + oldPt;
-							if (k == reversePoint)
-							{
-								reverse = true;
-								readOfs -= 2;
-							}
-							if (reverse)
-							{
-								newPt = -*(int16_t *)(songData + songDataOfs + subOfs + readOfs) + oldPt;
-								readOfs -= 2;
-							}
-							else
-							{
-								newPt = *(int16_t *)(songData + songDataOfs + subOfs + readOfs) + oldPt;
-								readOfs += 2;
-							}
-							*(int16_t *)(sampleData + sampleWriteOfs) = newPt;
-							sampleWriteOfs += 2;
+			int16_t patternLeng = *(int16_t *)(patternData + patternAddr[pat]);
+			int32_t *rowFirst = rowEvents + patternRowBase[pat];
 
-							oldPt = newPt;
-							k ++;
-						}
-					}
-					else
-					{
-						int8_t newPt;
-						while (k < sampleLeng)
-						{
-							if (k == reversePoint)
-							{
-								reverse = true;
-								readOfs --;
-							}
-							if (reverse)
-							{
-								newPt = -songData[songDataOfs + subOfs + readOfs] + oldPt;
-								readOfs --;
-							}
-							else
-							{
-								newPt = songData[songDataOfs + subOfs + readOfs] + oldPt;
-								readOfs ++;
-							}
-							sampleData[sampleWriteOfs++] = newPt;
+			int16_t row = 0;
+			while (row < patternLeng)
+			{
+				const Note *notes = PatternRow(pat, row, scanRow);
+				rowFirst[row] = eventNum;
 
-							oldPt = newPt;
-							k ++;
-						}
+				int16_t ch = 0;
+				while (ch < numOfChannels)
+				{
+					const Note &note = notes[ch];
+					if (note.note | note.instrument | note.volCmd | note.effect | note.parameter)
+					{
+						CellEvent &cell = cellEvents[eventNum++];
+						cell.note = note;
+						cell.channel = ch;
+						cell.tickEffect = HasTickEffect(note);
 					}
-
-					j ++;
-					//sampleNum ++ ;
+					ch ++;
 				}
-				songDataOfs += 40 * instSampleNum + sampleDataOfs;
+				row ++;
 			}
-			i ++;
+			rowFirst[patternLeng] = eventNum;
+			pat ++;
 		}
-
-		if (sampleHeaderAddr != NULL) free(sampleHeaderAddr);
-		if (sampleStartIndex != NULL) free(sampleStartIndex);
-
-		if (songData != NULL) free(songData);
-
-		ResetModule();
-		songLoaded = true;
+		rowEvents[rowNum] = eventNum;
 
 		return true;
 	}
 
-	static Note GetNote(uint8_t pos, uint8_t row, uint8_t col)
+	//Envelope points past the 12 stored ones or out of order are dropped, sustain and loop points
+	//are kept inside the envelope and an envelope without points is turned off
+	static void ClampEnvelope(int16_t *envelope, int8_t &points, uint8_t &sustainPt, uint8_t &loopStart, uint8_t &loopEnd, int8_t &type)
 	{
-		Note thisNote = *(Note *)(patternData + patternAddr[pos] + ROW_SIZE_XM * row + col * NOTE_SIZE_XM + 2);
+		uint8_t j = 1;
+		uint8_t maxPoints = MIN((uint8_t)points, 12);
+		while (j < maxPoints && envelope[j * 2] > envelope[(j - 1) * 2])
+			j ++;
+		points = maxPoints > 0 ? j : 0;
 
-		return thisNote;
+		if (points == 0)
+		{
+			type &= ~0x01;
+			return;
+		}
+
+		sustainPt = MIN(sustainPt, points - 1);
+		loopStart = MIN(loopStart, points - 1);
+		loopEnd = MIN(loopEnd, points - 1);
+	}
+
+	static EnvInfo CalcEnvelope(const Instrument &inst, int16_t pos, bool calcPan);
+
+#define ENV_RASTER_MAX 1024
+
+	//Sustain, loop and end positions of an envelope and how many values it rasterises to
+	static uint32_t ResolveEnvelope(const Instrument &inst, bool calcPan, EnvTrack &track)
+	{
+		const int16_t *envData = calcPan ? inst.panEnvelops : inst.volEnvelops;
+		int8_t numOfPoints = calcPan ? inst.panPoints : inst.volPoints;
+
+		memset(&track, 0, sizeof(EnvTrack));
+		if (inst.sampleNum <= 0 || numOfPoints <= 0) return 0;
+
+		track.end = envData[(numOfPoints - 1) * 2];
+		track.sustain = envData[(calcPan ? inst.panSustainPt : inst.volSustainPt) * 2];
+		track.loopStart = envData[(calcPan ? inst.panLoopStart : inst.volLoopStart) * 2];
+		track.loopEnd = envData[(calcPan ? inst.panLoopEnd : inst.volLoopEnd) * 2];
+
+		int8_t type = calcPan ? inst.panType : inst.volType;
+		return (type & 0x01) && track.end >= 0 && track.end < ENV_RASTER_MAX ? track.end + 1 : 0;
+	}
+
+	//Resolves an envelope into track and rasterises it to values, returns where the next one goes
+	static uint8_t *RasteriseEnvelope(const Instrument &inst, bool calcPan, EnvTrack &track, uint8_t *values)
+	{
+		uint32_t leng = ResolveEnvelope(inst, calcPan, track);
+		if (leng == 0) return values;
+
+		track.values = values;
+		int16_t pos = 0;
+		while (pos < (int16_t)leng)
+		{
+			values[pos] = CalcEnvelope(inst, pos, calcPan).value;
+			pos ++;
+		}
+
+		return values + leng;
+	}
+
+	//Copies what playback reads every tick out of an instrument and rasterises its volume and pan
+	//envelopes to values, returns where the next instrument's values go
+	static uint8_t *BuildHotInstrument(int16_t instNum, uint8_t *values)
+	{
+		const Instrument &inst = instruments[instNum];
+		HotInstrument &hot = hotInstruments[instNum];
+
+		values = RasteriseEnvelope(inst, false, hot.volEnv, values);
+		values = RasteriseEnvelope(inst, true, hot.panEnv, values);
+		hot.fadeOut = inst.fadeOut;
+		hot.volType = inst.volType;
+		hot.panType = inst.panType;
+		hot.vibratoType = inst.vibratoType;
+		hot.vibratoSweep = inst.vibratoSweep;
+		hot.vibratoDepth = inst.vibratoDepth;
+		hot.vibratoRate = inst.vibratoRate;
+
+		return values;
+	}
+
+	//Builds every instrument's hot copy, so playback looks envelope values up instead of interpolating
+	//between the points
+	static bool BuildHotInstruments()
+	{
+		EnvTrack track;
+		uint32_t valueNum = 0;
+		int32_t i = 0;
+		while (i < numOfInstruments)
+		{
+			valueNum += ResolveEnvelope(instruments[i], false, track);
+			valueNum += ResolveEnvelope(instruments[i], true, track);
+			i ++;
+		}
+
+		hotInstSize = MAX(numOfInstruments, 1) * sizeof(HotInstrument) + valueNum;
+		hotInstruments = (HotInstrument *)malloc(hotInstSize);
+		if (hotInstruments == NULL) return false;
+		LoadHold(hotInstSize);
+
+		uint8_t *values = (uint8_t *)(hotInstruments + MAX(numOfInstruments, 1));
+		i = 0;
+		while (i < numOfInstruments)
+			values = BuildHotInstrument(i++, values);
+
+		hotInstReady.store(numOfInstruments, std::memory_order_release);
+		return true;
+	}
+
+	//Instrument header, firstSample is the global index of the instrument's first sample
+	//Sample map entries past the instrument's own samples map to no sample (-1)
+	static void ParseInstrument(const uint8_t *src, Instrument &inst, int32_t firstSample)
+	{
+		int j, k;
+		int16_t instSampleNum = *(int16_t *)(src + 27);
+		inst.sampleNum = instSampleNum;
+
+		//name
+		k = 0;
+		while (k < 22)
+		{
+			inst.name[k] = src[4 + k];
+			k ++;
+		}
+
+		if (instSampleNum > 0)
+		{
+			//note mapping
+			j = 0;
+			while (j < 96)
+			{
+				inst.sampleMap[j] = src[33 + j] < instSampleNum ? firstSample + src[33 + j] : -1;
+				j ++;
+			}
+
+			//Vol envelopes
+			j = 0;
+			while (j < 24)
+			{
+				inst.volEnvelops[j] = *(int16_t *)(src + 129 + j * 2);
+				j ++;
+			}
+
+			//pan envelopes
+			j = 0;
+			while (j < 24)
+			{
+				inst.panEnvelops[j] = *(int16_t *)(src + 177 + j * 2);
+				j ++;
+			}
+
+			inst.volPoints = src[225];
+			inst.panPoints = src[226];
+			inst.volSustainPt = src[227];
+			inst.volLoopStart = src[228];
+			inst.volLoopEnd = src[229];
+			inst.panSustainPt = src[230];
+			inst.panLoopStart = src[231];
+			inst.panLoopEnd = src[232];
+			inst.volType = src[233];
+			inst.panType = src[234];
+			inst.vibratoType = src[235];
+			inst.vibratoSweep = src[236];
+			inst.vibratoDepth = src[237];
+			inst.vibratoRate = src[238];
+			inst.fadeOut = *(int16_t *)(src + 239);
+
+			ClampEnvelope(inst.volEnvelops, inst.volPoints, inst.volSustainPt, inst.volLoopStart, inst.volLoopEnd, inst.volType);
+			ClampEnvelope(inst.panEnvelops, inst.panPoints, inst.panSustainPt, inst.panLoopStart, inst.panLoopEnd, inst.panType);
+		}
+	}
+
+	//Copies a 40 byte sample header with the length clamped to the sample data available in the
+	//module and the loop clamped to the sample, a loop of length 0 is turned off
+	//Loaders parse the copy so the mixer never reads past a sample or wraps a loop by 0
+	static void ClampSampleHeader(const uint8_t *src, uint8_t *dst, uint32_t available)
+	{
+		memcpy(dst, src, 40);
+
+		uint32_t sampleLeng = MIN(MIN(*(uint32_t *)(src), available), SAMPLE_BYTES_MAX);
+		uint32_t loopStart = *(uint32_t *)(src + 4);
+		uint32_t loopLeng = *(uint32_t *)(src + 8);
+
+		//Whole frames only
+		if (src[14] & 0x10)
+		{
+			sampleLeng &= ~1u;
+			loopStart &= ~1u;
+			loopLeng &= ~1u;
+		}
+
+		loopStart = MIN(loopStart, sampleLeng);
+		loopLeng = MIN(loopLeng, sampleLeng - loopStart);
+		if (loopLeng == 0) dst[14] &= ~0x03;
+
+		*(uint32_t *)(dst) = sampleLeng;
+		*(uint32_t *)(dst + 4) = loopStart;
+		*(uint32_t *)(dst + 8) = loopLeng;
+	}
+
+	//40 byte sample header, everything except the data pointer
+	static void ParseSampleHeader(const uint8_t *src, Sample &smp, uint8_t instNum)
+	{
+		int32_t sampleLeng = *(int32_t *)(src);
+		int32_t loopStart = *(int32_t *)(src + 4);
+		int32_t loopLeng = *(int32_t *)(src + 8);
+		int8_t sampleType = src[14];
+		bool is16Bit = (sampleType & 0x10);
+
+		smp.origInst = instNum;
+		smp.type = sampleType & 0x03;
+		smp.is16Bit = is16Bit;
+
+		smp.volume = src[12];
+		smp.pan = src[15];
+		smp.fineTune = *(int8_t *)(src + 13);
+		smp.relNote = *(int8_t *)(src + 16);
+
+		int k = 0;
+		while (k < 22)
+		{
+			smp.name[k] = src[18 + k];
+			k ++;
+		}
+
+		if (is16Bit)
+		{
+			smp.length = sampleLeng >> 1;
+			smp.loopStart = loopStart >> 1;
+			smp.loopLength = loopLeng >> 1;
+		}
+		else
+		{
+			smp.length = sampleLeng;
+			smp.loopStart = loopStart;
+			smp.loopLength = loopLeng;
+		}
+	}
+
+	//Frames kept in sampleData for a sample header, bidi loops are unrolled after reverseFrame (-1 for other loop types)
+	//Without unrollBidi a bidi loop is stored like a forward loop and the mixer plays it backwards itself
+	static int32_t CalcSampleStorage(const uint8_t *src, int32_t &reverseFrame, bool unrollBidi)
+	{
+		int32_t sampleLeng = *(int32_t *)(src);
+		int32_t loopStart = *(int32_t *)(src + 4);
+		int32_t loopLeng = *(int32_t *)(src + 8);
+		int8_t sampleType = src[14] & 0x03;
+
+		int32_t reversePoint = -1;
+		if (sampleType == 1 || (sampleType >= 2 && !unrollBidi))
+			sampleLeng = loopStart + loopLeng;
+		else if (sampleType >= 2)
+		{
+			reversePoint = loopStart + loopLeng;
+			sampleLeng = reversePoint + loopLeng;
+		}
+
+		if (src[14] & 0x10)
+		{
+			sampleLeng >>= 1;
+			reversePoint >>= 1;
+		}
+
+		reverseFrame = reversePoint;
+		return sampleLeng;
+	}
+
+	//First frame of the loop, -1 for samples without one. A stored loop always runs to the last stored frame
+	static int32_t LoopStartFrame(const uint8_t *src)
+	{
+		if (!(src[14] & 0x03)) return -1;
+
+		int32_t loopStart = *(int32_t *)(src + 4);
+		return (src[14] & 0x10) ? loopStart >> 1 : loopStart;
+	}
+
+	//Sample storage formats, SAMPLE_NATIVE keeps 8-bit and 16-bit samples as they are
+	enum SampleFormat
+	{
+		SAMPLE_NATIVE,
+		SAMPLE_INT16,
+		SAMPLE_FLOAT
+	};
+
+	static inline int32_t SampleFrameBytes(bool is16Bit, int8_t format)
+	{
+		if (format == SAMPLE_FLOAT) return 4;
+		return (is16Bit || format == SAMPLE_INT16) ? 2 : 1;
+	}
+
+	//Every sample takes GUARD_FRAMES extra frames on both sides in sampleData, see FillGuardFrames()
+	static inline int64_t SampleStorageBytes(int32_t frames, bool is16Bit, int8_t format)
+	{
+		return (int64_t)(frames + GUARD_FRAMES * 2) * SampleFrameBytes(is16Bit, format);
+	}
+
+	//What the patterns in the order list use, see SetPruneUnused(). Bxx only jumps to order
+	//positions and SetPos() can start at any of them, so every pattern in the order list is live
+	struct LiveSet
+	{
+		bool pattern[256];
+		bool instrument[256];
+		bool note[97];
+	};
+
+	static LiveSet liveSet;
+
+	//Everything is live without pruning, otherwise the order list's patterns until MarkLiveCells() adds what they use
+	static void BeginLiveSet()
+	{
+		memset(&liveSet, !unusedPruned, sizeof(LiveSet));
+		prunedSize = 0;
+		if (!unusedPruned) return;
+
+		int16_t pos = 0;
+		while (pos < songLength)
+			liveSet.pattern[orderTable[pos++]] = true;
+	}
+
+	//Instruments and notes in a live pattern's packed cells
+	static void MarkLiveCells(const uint8_t *src, int32_t srcLeng, int16_t patternLeng)
+	{
+		uint8_t note[NOTE_SIZE_XM];
+		int32_t noteNum = patternLeng * numOfChannels;
+		int32_t srcOfs = 0;
+		while (noteNum > 0 && srcOfs < srcLeng)
+		{
+			srcOfs = UnpackNote(src, srcLeng, srcOfs, note);
+			if (srcOfs < 0) break;
+
+			liveSet.instrument[note[1]] = true;
+			if (note[0] <= 96) liveSet.note[note[0]] = true;
+			noteNum --;
+		}
+	}
+
+	//Patterns outside the order list are stored without rows
+	static void PrunePattern(int16_t &patternLeng, int32_t &patternSize, bool count)
+	{
+		if (count) prunedSize += PatternStorageSize(patternLeng, patternSize) - PatternStorageSize(0, 0);
+		patternLeng = 0;
+		patternSize = 0;
+	}
+
+	//Whether a note can trigger sample smpNum, inst is instrument instNum (from 1) parsed with its sample numbers
+	//Notes and instruments are paired loosely (a note plays with the channel's last instrument), so any
+	//note in the live patterns counts for every live instrument
+	static bool SampleLive(uint8_t instNum, const Instrument &inst, int32_t smpNum)
+	{
+		if (!unusedPruned) return true;
+		if (!liveSet.instrument[instNum]) return false;
+
+		int16_t note = 1;
+		while (note <= 96)
+		{
+			if (liveSet.note[note] && inst.sampleMap[note - 1] == smpNum) return true;
+			note ++;
+		}
+
+		return false;
+	}
+
+	//Sample data bytes ClampSampleHeader() gets to use, none for a sample that is never played
+	static uint32_t SampleAvailable(const uint8_t *src, uint32_t available, bool live, bool count)
+	{
+		if (live) return available;
+
+		if (count)
+		{
+			uint8_t sampleHeader[40];
+			ClampSampleHeader(src, sampleHeader, available);
+
+			int32_t reverseFrame;
+			int32_t frames = CalcSampleStorage(sampleHeader, reverseFrame, bidiUnrolled);
+			prunedSize += SampleStorageBytes(frames, sampleHeader[14] & 0x10, sampleFormat) - SampleStorageBytes(0, sampleHeader[14] & 0x10, sampleFormat);
+		}
+
+		return 0;
+	}
+
+	uint64_t HashModule(const uint8_t *data, uint32_t dataLeng);
+
+	//Earlier live pattern with the same rows and packed notes, -1 if there is none
+	//headers are the module's pattern headers, origins what was found for the earlier ones
+	static int16_t FindSharedPattern(const uint8_t *const *headers, const int16_t *origins, int16_t patNum)
+	{
+		const uint8_t *header = headers[patNum];
+		uint16_t patternSize = *(uint16_t *)(header + 7);
+
+		int16_t k = 0;
+		while (k < patNum)
+		{
+			const uint8_t *other = headers[k];
+			if (liveSet.pattern[k] && origins[k] < 0 && PatternRows(other) == PatternRows(header) && *(uint16_t *)(other + 7) == patternSize
+				&& memcmp(other + *(int32_t *)other, header + *(int32_t *)header, patternSize) == 0)
+				return k;
+			k ++;
+		}
+
+		return -1;
+	}
+
+	//Bytes a pattern takes in patternData, read from the stored pattern
+	static int32_t StoredPatternSize(int16_t patNum)
+	{
+		const uint8_t *pat = patternData + patternAddr[patNum];
+		return PatternStorageSize(*(int16_t *)pat, patternsCompact ? *(uint16_t *)(pat + 2) : 0);
+	}
+
+	//What a sample's stored data is made from, samples with equal keys store the same bytes
+	//LoadModule() keys the packed data and the header fields that shape it, the streaming loader
+	//keys the stored data itself (src NULL, layout[0] the stored size)
+	struct SampleKey
+	{
+		uint64_t hash;      //See KeyHash()
+		bool hashed;
+		const uint8_t *src;
+		uint32_t layout[4]; //Clamped length, loop start and loop length, type bits 0, 1 and 4
+		int32_t origin;     //Earlier sample holding the data, -1 if this one stores it
+	};
+
+	//Load time only, reused across loads and freed with the arena
+	static SampleKey *sampleKeys;
+	static int32_t sampleKeyCap;
+
+	static bool ReserveSampleKeys(int32_t keyNum)
+	{
+		if (keyNum <= sampleKeyCap) return true;
+
+		int32_t newCap = MAX(keyNum, sampleKeyCap * 2);
+		SampleKey *newKeys = (SampleKey *)realloc(sampleKeys, newCap * sizeof(SampleKey));
+		if (newKeys == NULL) return false;
+
+		LoadHold((newCap - sampleKeyCap) * sizeof(SampleKey));
+		sampleKeys = newKeys;
+		sampleKeyCap = newCap;
+		return true;
+	}
+
+	//Fills in sampleKeys[keyNum] for a clamped sample header and its packed data, origin is the
+	//first earlier sample with the same key
+	//Hash of the bytes a key stands for, only worked out once another key has the same layout
+	static uint64_t KeyHash(SampleKey &key, const uint8_t *data)
+	{
+		if (!key.hashed)
+		{
+			key.hash = HashModule(data, key.layout[0]);
+			key.hashed = true;
+		}
+
+		return key.hash;
+	}
+
+	static bool AddSampleKey(int32_t keyNum, const uint8_t *sampleHeader, const uint8_t *src)
+	{
+		if (!ReserveSampleKeys(keyNum + 1)) return false;
+
+		SampleKey &key = sampleKeys[keyNum];
+		key.src = src;
+		key.layout[0] = *(uint32_t *)(sampleHeader);
+		key.layout[1] = *(uint32_t *)(sampleHeader + 4);
+		key.layout[2] = *(uint32_t *)(sampleHeader + 8);
+		key.layout[3] = sampleHeader[14] & 0x13;
+		key.hashed = false;
+		key.origin = -1;
+
+		int32_t k = 0;
+		while (k < keyNum)
+		{
+			SampleKey &other = sampleKeys[k];
+			if (other.origin < 0 && memcmp(other.layout, key.layout, sizeof(key.layout)) == 0
+				&& KeyHash(other, other.src) == KeyHash(key, src) && memcmp(other.src, src, key.layout[0]) == 0)
+			{
+				key.origin = k;
+				break;
+			}
+			k ++;
+		}
+
+		return true;
+	}
+
+	//Delta decoding, oldPt carries the running value so data can be decoded in pieces
+	//The SSE2 path does a 16 (8) lane prefix sum per block and carries the last value across blocks
+	static void DecodeDelta8(const uint8_t *src, int8_t *dst, int32_t frames, int16_t &oldPt)
+	{
+		int8_t newPt;
+		int32_t k = 0;
+
+#ifdef __SSE2__
+		__m128i carry = _mm_set1_epi8((int8_t)oldPt);
+		while (k + 16 <= frames)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i *)(src + k));
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+			x = _mm_add_epi8(x, carry);
+			_mm_storeu_si128((__m128i *)(dst + k), x);
+
+			//Broadcast byte 15
+			carry = _mm_unpackhi_epi8(x, x);
+			carry = _mm_unpackhi_epi16(carry, carry);
+			carry = _mm_shuffle_epi32(carry, 0xFF);
+			k += 16;
+		}
+		oldPt = (int8_t)_mm_cvtsi128_si32(carry);
+#endif
+
+		while (k < frames)
+		{
+			newPt = src[k] + oldPt;
+			dst[k] = newPt;
+
+			oldPt = newPt;
+			k ++;
+		}
+	}
+
+	static void DecodeDelta16(const uint8_t *src, int8_t *dst, int32_t frames, int16_t &oldPt)
+	{
+		int16_t newPt;
+		int32_t k = 0;
+
+#ifdef __SSE2__
+		__m128i carry = _mm_set1_epi16(oldPt);
+		while (k + 8 <= frames)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i *)(src + (k << 1)));
+			x = _mm_add_epi16(x, _mm_slli_si128(x, 2));
+			x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+			x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+			x = _mm_add_epi16(x, carry);
+			_mm_storeu_si128((__m128i *)(dst + (k << 1)), x);
+
+			//Broadcast word 7
+			carry = _mm_shufflehi_epi16(x, 0xFF);
+			carry = _mm_shuffle_epi32(carry, 0xFF);
+			k += 8;
+		}
+		oldPt = (int16_t)_mm_cvtsi128_si32(carry);
+#endif
+
+		while (k < frames)
+		{
+			newPt = *(int16_t *)(src + (k << 1)) + oldPt;
+			*(int16_t *)(dst + (k << 1)) = newPt;
+
+			oldPt = newPt;
+			k ++;
+		}
+	}
+
+	//Unrolls a bidi loop: the frames after reverseFrame play the loop backwards
+	//Source frames are all before reverseFrame so whole blocks can be reverse copied
+	static void MirrorLoop(int8_t *dst, int32_t reverseFrame, int32_t frames, bool is16Bit)
+	{
+		int32_t k = reverseFrame;
+		int32_t readPos = reverseFrame - 2;
+
+#ifdef __SSE2__
+		if (is16Bit)
+		{
+			while (k + 8 <= frames && readPos >= 7)
+			{
+				__m128i x = _mm_loadu_si128((const __m128i *)(dst + ((readPos - 7) << 1)));
+				x = _mm_shuffle_epi32(x, 0x1B);
+				x = _mm_shufflelo_epi16(x, 0xB1);
+				x = _mm_shufflehi_epi16(x, 0xB1);
+				_mm_storeu_si128((__m128i *)(dst + (k << 1)), x);
+
+				readPos -= 8;
+				k += 8;
+			}
+		}
+		else
+		{
+			while (k + 16 <= frames && readPos >= 15)
+			{
+				__m128i x = _mm_loadu_si128((const __m128i *)(dst + readPos - 15));
+				x = _mm_shuffle_epi32(x, 0x1B);
+				x = _mm_shufflelo_epi16(x, 0xB1);
+				x = _mm_shufflehi_epi16(x, 0xB1);
+				x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+				_mm_storeu_si128((__m128i *)(dst + k), x);
+
+				readPos -= 16;
+				k += 16;
+			}
+		}
+#endif
+
+		while (k < frames)
+		{
+			if (is16Bit)
+				*(int16_t *)(dst + (k << 1)) = readPos >= 0 ? *(int16_t *)(dst + (readPos << 1)) : 0;
+			else
+				dst[k] = readPos >= 0 ? dst[readPos] : 0;
+
+			readPos --;
+			k ++;
+		}
+	}
+
+	//The frames before the sample repeat the first frame, the frames after it continue the loop
+	//(or repeat the last frame), so the mixer can read next to any position without edge checks
+	static void FillGuardFrames(int8_t *dst, int32_t frames, int32_t loopFrame, int32_t frameBytes)
+	{
+		int32_t k = 0;
+		while (k < GUARD_FRAMES)
+		{
+			int8_t *before = dst - (k + 1) * frameBytes;
+			int8_t *after = dst + (int64_t)(frames + k) * frameBytes;
+
+			if (frames > 0)
+			{
+				int32_t readPos = loopFrame >= 0 ? loopFrame + k % (frames - loopFrame) : frames - 1;
+				memcpy(before, dst, frameBytes);
+				memcpy(after, dst + (int64_t)readPos * frameBytes, frameBytes);
+			}
+			else
+			{
+				memset(before, 0, frameBytes);
+				memset(after, 0, frameBytes);
+			}
+			k ++;
+		}
+	}
+
+	//Converts decoded frames to sampleFormat, src is the end of the same space so this runs front to back
+	//Values keep the 16-bit range the mixer works in, 8-bit frames are shifted up like the 8-bit kernels do
+	static void WidenSample(const int8_t *src, int8_t *dst, int32_t frames, bool is16Bit)
+	{
+		int32_t k = 0;
+		while (k < frames)
+		{
+			int16_t value = is16Bit ? *(const int16_t *)(src + (k << 1)) : (int16_t)(src[k] << 8);
+
+			if (sampleFormat == SAMPLE_FLOAT) ((float *)dst)[k] = value;
+			else ((int16_t *)dst)[k] = value;
+			k ++;
+		}
+	}
+
+	//Where a sample is decoded to before WidenSample(), dst itself unless the format is wider
+	static inline int8_t *WidenSource(int8_t *dst, int32_t frames, bool is16Bit)
+	{
+		return dst + (int64_t)frames * SampleFrameBytes(is16Bit, sampleFormat) - (is16Bit ? (int64_t)frames << 1 : frames);
+	}
+
+	static void DecodeSample(const uint8_t *src, int8_t *dst, int32_t frames, int32_t reverseFrame, int32_t loopFrame, bool is16Bit)
+	{
+		int32_t forwardFrames = reverseFrame >= 0 ? MIN(reverseFrame, frames) : frames;
+		int8_t *decodeDst = WidenSource(dst, frames, is16Bit);
+
+		int16_t oldPt = 0;
+		if (is16Bit) DecodeDelta16(src, decodeDst, forwardFrames, oldPt);
+		else DecodeDelta8(src, decodeDst, forwardFrames, oldPt);
+
+		if (reverseFrame >= 0)
+			MirrorLoop(decodeDst, reverseFrame, frames, is16Bit);
+
+		if (decodeDst != dst)
+			WidenSample(decodeDst, dst, frames, is16Bit);
+
+		FillGuardFrames(dst, frames, loopFrame, SampleFrameBytes(is16Bit, sampleFormat));
+	}
+
+	//Unpacking work collected by LoadModule(), every job writes its own slice of patternData or sampleData
+	enum DecodeJobType
+	{
+		JOB_PATTERN,
+		JOB_SAMPLE_8BIT,
+		JOB_SAMPLE_16BIT,
+		JOB_SAMPLE_SHARED   //Data of sample origin, nothing to decode
+	};
+
+	struct DecodeJob
+	{
+		const uint8_t *src;
+		int8_t *dst;
+		int32_t srcLeng;
+		int32_t frames;
+		int32_t reverseFrame;
+		int32_t loopFrame;
+		int32_t origin;
+		int8_t type;
+	};
+
+	static void RunDecodeJob(const DecodeJob &job)
+	{
+		if (job.type == JOB_PATTERN && patternsCompact)
+			IndexPattern(job.src, job.srcLeng, (uint8_t *)job.dst, job.frames);
+		else if (job.type == JOB_PATTERN)
+			UnpackPattern(job.src, job.srcLeng, (uint8_t *)job.dst, job.frames);
+		else if (job.type != JOB_SAMPLE_SHARED)
+			DecodeSample(job.src, job.dst, job.frames, job.reverseFrame, job.loopFrame, job.type == JOB_SAMPLE_16BIT);
+	}
+
+	static void DecodeWorker(const DecodeJob *jobs, int32_t jobNum, std::atomic<int32_t> *nextJob)
+	{
+		int32_t i;
+		while ((i = nextJob->fetch_add(1)) < jobNum)
+			RunDecodeJob(jobs[i]);
+	}
+
+	//workSize is the number of bytes written by all jobs, small modules are not worth starting threads for
+	static void RunDecodeJobs(const DecodeJob *jobs, int32_t jobNum, int32_t workSize)
+	{
+		int threadNum = std::thread::hardware_concurrency();
+		if (threadNum > LOAD_THREADS_MAX) threadNum = LOAD_THREADS_MAX;
+		if (threadNum > jobNum) threadNum = jobNum;
+		if (workSize < PARALLEL_LOAD_MIN) threadNum = 1;
+
+		std::atomic<int32_t> nextJob(0);
+		std::thread workers[LOAD_THREADS_MAX];
+		int started = 0;
+		while (started < threadNum - 1)
+		{
+			//Fall back to fewer threads (or none) if the system refuses to create more
+			try
+			{
+				workers[started] = std::thread(DecodeWorker, jobs, jobNum, &nextJob);
+			}
+			catch (...)
+			{
+				break;
+			}
+			started ++;
+		}
+
+		DecodeWorker(jobs, jobNum, &nextJob);
+
+		int i = 0;
+		while (i < started)
+			workers[i++].join();
+	}
+
+	//Compressed sample store, see SetCompressSamples()
+	//The stored frames of every sample (guard frames included) are cut into BLOCK_FRAMES frame blocks.
+	//A block holds the frame before it and a bit width, then the delta to each of its frames zigzag
+	//coded and packed at that width. Blocks the deltas don't make smaller (noise) keep the frames
+	//themselves, flagged by BLOCK_RAW in the width. blockOfs indexes every block so any position is
+	//one lookup away.
+	static uint8_t *blockData;
+	static uint32_t *blockOfs;
+
+	//Frames a sample takes in sampleData without its guard frames, bidi loops are unrolled
+	static int32_t StoredFrames(const Sample &smp)
+	{
+		if (smp.type == 0) return smp.length;
+		if (smp.type == 1) return smp.loopStart + smp.loopLength;
+		return smp.loopStart + (smp.loopLength << 1);
+	}
+
+	static inline int32_t StoredBlocks(const Sample &smp)
+	{
+		return (StoredFrames(smp) + GUARD_FRAMES * 2 + BLOCK_FRAMES - 1) / BLOCK_FRAMES;
+	}
+
+	//Frame s of a decoded sample counted from its first guard frame
+	static inline int32_t GuardedFrame(const Sample &smp, int32_t s)
+	{
+		s -= GUARD_FRAMES;
+		return smp.is16Bit ? *(int16_t *)(smp.data + (s << 1)) : smp.data[s];
+	}
+
+	//Returns the bytes the block takes, dst can be NULL to only count them
+	static uint32_t EncodeBlock(const Sample &smp, int32_t block, uint8_t *dst)
+	{
+		int32_t first = block * BLOCK_FRAMES;
+		int32_t frames = MIN(BLOCK_FRAMES, StoredFrames(smp) + GUARD_FRAMES * 2 - first);
+		int32_t prev = GuardedFrame(smp, MAX(first - 1, 0));
+
+		uint32_t zigzagBits = 0;
+		int32_t value = prev;
+		int32_t k = 0;
+		while (k < frames)
+		{
+			int32_t next = GuardedFrame(smp, first + k);
+			int32_t delta = next - value;
+			zigzagBits |= ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+			value = next;
+			k ++;
+		}
+
+		int32_t bits = 0;
+		while (zigzagBits >> bits) bits ++;
+
+		int32_t frameBits = smp.is16Bit ? 16 : 8;
+		bool raw = bits > frameBits;
+		if (raw) bits = frameBits;
+
+		uint32_t bytes = 3 + ((frames * bits + 7) >> 3);
+		if (dst == NULL) return bytes;
+
+		*(int16_t *)dst = prev;
+		dst[2] = raw ? bits | BLOCK_RAW : bits;
+		dst += 3;
+
+		uint64_t acc = 0;
+		int32_t accBits = 0;
+		value = prev;
+		k = 0;
+		while (k < frames)
+		{
+			int32_t next = GuardedFrame(smp, first + k);
+			int32_t delta = next - value;
+			uint32_t code = raw ? (uint32_t)next & ((1u << bits) - 1) : ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+			acc |= (uint64_t)code << accBits;
+			accBits += bits;
+			while (accBits >= 8)
+			{
+				*dst++ = (uint8_t)acc;
+				acc >>= 8;
+				accBits -= 8;
+			}
+			value = next;
+			k ++;
+		}
+		if (accBits > 0) *dst = (uint8_t)acc;
+
+		return bytes;
+	}
+
+	//Earlier sample whose data smpNum shares, -1 if it has its own
+	static int32_t SharedDataSample(int32_t smpNum)
+	{
+		int32_t k = 0;
+		while (k < smpNum)
+		{
+			if (samples[k].data == samples[smpNum].data) return k;
+			k ++;
+		}
+
+		return -1;
+	}
+
+	//Replaces the decoded samples by blocks, the caller frees the decoded samples afterwards
+	static bool CompressSamples()
+	{
+		//Samples sharing data share blocks
+		int32_t blockNum = 0;
+		int32_t i = 0;
+		while (i < totalSampleNum)
+		{
+			int32_t shared = SharedDataSample(i);
+			if (shared >= 0)
+				samples[i].firstBlock = samples[shared].firstBlock;
+			else
+			{
+				samples[i].firstBlock = blockNum;
+				blockNum += StoredBlocks(samples[i]);
+			}
+			i ++;
+		}
+
+		blockOfs = (uint32_t *)malloc(MAX(blockNum, 1) * sizeof(uint32_t));
+		if (blockOfs == NULL) return false;
+
+		uint64_t size = 0;
+		i = 0;
+		while (i < totalSampleNum)
+		{
+			int32_t block = SharedDataSample(i) < 0 ? 0 : StoredBlocks(samples[i]);
+			while (block < StoredBlocks(samples[i]))
+			{
+				blockOfs[samples[i].firstBlock + block] = size;
+				size += EncodeBlock(samples[i], block, NULL);
+				block ++;
+			}
+			i ++;
+		}
+
+		//8 bytes of padding so LoadSampleBlock() can always read whole words
+		if (size + 8 + blockNum * sizeof(uint32_t) > INT32_MAX) return false;
+		blockData = (uint8_t *)malloc(size + 8);
+		if (blockData == NULL) return false;
+		memset(blockData + size, 0, 8);
+		LoadHold(size + 8 + MAX(blockNum, 1) * sizeof(uint32_t));
+
+		i = 0;
+		while (i < totalSampleNum)
+		{
+			int32_t block = SharedDataSample(i) < 0 ? 0 : StoredBlocks(samples[i]);
+			while (block < StoredBlocks(samples[i]))
+			{
+				EncodeBlock(samples[i], block, blockData + blockOfs[samples[i].firstBlock + block]);
+				block ++;
+			}
+			i ++;
+		}
+
+		i = 0;
+		while (i < totalSampleNum)
+			samples[i++].data = NULL;
+
+		voiceBlocks = (VoiceBlock *)malloc(numOfChannels * sizeof(VoiceBlock));
+		if (voiceBlocks == NULL) return false;
+		LoadHold(numOfChannels * sizeof(VoiceBlock));
+
+		i = 0;
+		while (i < numOfChannels)
+			voiceBlocks[i++].sample = -1;
+
+		totalSampleSize = size + 8 + blockNum * sizeof(uint32_t);
+		return true;
+	}
+
+	//Decodes the block holding frame pos (and the frame before it) of the channel's sample
+	//8-bit samples come out shifted up, so the mixer reads every compressed sample as 16-bit
+	static void LoadSampleBlock(Channel &ch, VoiceBlock &voice, int32_t pos)
+	{
+		const Sample &smp = samples[ch.samplePlaying];
+		int32_t block = (pos + GUARD_FRAMES) / BLOCK_FRAMES;
+		int32_t first = block * BLOCK_FRAMES - GUARD_FRAMES;
+		int32_t frames = MIN(BLOCK_FRAMES, StoredFrames(smp) + GUARD_FRAMES - first);
+
+		const uint8_t *src = blockData + blockOfs[smp.firstBlock + block];
+		int32_t value = *(const int16_t *)src;
+		int32_t bits = src[2] & ~BLOCK_RAW;
+		uint32_t mask = (1u << bits) - 1;
+		int32_t shift = smp.is16Bit ? 0 : 8;
+		bool raw = src[2] & BLOCK_RAW;
+		src += 3;
+
+		voice.data[0] = value << shift;
+		uint32_t bitPos = 0;
+		int32_t k = 0;
+		while (k < frames)
+		{
+			uint64_t word;
+			memcpy(&word, src + (bitPos >> 3), 8);
+			uint32_t code = (uint32_t)(word >> (bitPos & 7)) & mask;
+
+			//Raw frames are sign extended from their width
+			if (raw) value = (int32_t)(code << (32 - bits)) >> (32 - bits);
+			else value += (int32_t)(code >> 1) ^ -(int32_t)(code & 1);
+
+			voice.data[k + 1] = value << shift;
+			bitPos += bits;
+			k ++;
+		}
+
+		voice.sample = ch.samplePlaying;
+		voice.first = first;
+		ch.data = (int8_t *)(voice.data + 1) - (intptr_t)first * 2;
+	}
+
+	//Lazy sample decoding, see SetLazyDecoding()
+	//Samples used by the first lazyOrders orders are decoded by LoadModule(), the rest on a background
+	//thread in order of first use. ChkNote() decodes a sample itself if it gets there first.
+	enum SampleState
+	{
+		SAMPLE_PENDING,
+		SAMPLE_DECODING,
+		SAMPLE_READY
+	};
+
+	static int16_t lazyOrders = 0;
+	static DecodeJob *sampleJobs;
+	static std::atomic<uint8_t> *sampleState;
+	static int16_t *lazyOrder;
+	static std::thread *lazyThread;
+	static std::atomic<bool> lazyStop;
+
+	//Packed sample data the jobs read from, either a copy or the mapping of LoadModuleFromFile()
+	static void *lazySource;
+	static size_t lazySourceSize;
+	static bool lazySourceMapped;
+
+	//Set for a module that plays while it streams in, the loader owns each sample (SAMPLE_DECODING)
+	//until its last chunk is decoded and ChkNote() skips it until then instead of waiting
+	static bool streamedSamples;
+
+	static void EnsureSampleDecoded(int16_t smpNum);
+
+	//Returns false if another thread owns the sample
+	static bool ClaimAndDecode(int16_t smpNum)
+	{
+		uint8_t expected = SAMPLE_PENDING;
+		if (!sampleState[smpNum].compare_exchange_strong(expected, SAMPLE_DECODING))
+			return expected == SAMPLE_READY;
+
+		if (sampleJobs[smpNum].type == JOB_SAMPLE_SHARED) EnsureSampleDecoded(sampleJobs[smpNum].origin);
+		else RunDecodeJob(sampleJobs[smpNum]);
+		sampleState[smpNum].store(SAMPLE_READY, std::memory_order_release);
+		return true;
+	}
+
+	static void EnsureSampleDecoded(int16_t smpNum)
+	{
+		if (sampleState == NULL || smpNum < 0) return;
+		if (sampleState[smpNum].load(std::memory_order_acquire) == SAMPLE_READY) return;
+
+		if (!ClaimAndDecode(smpNum))
+		{
+			while (sampleState[smpNum].load(std::memory_order_acquire) != SAMPLE_READY)
+				std::this_thread::yield();
+		}
+	}
+
+	static bool SampleArriving(int16_t smpNum)
+	{
+		return streamedSamples && sampleState[smpNum].load(std::memory_order_acquire) != SAMPLE_READY;
+	}
+
+	static void FinishLazyDecoding()
+	{
+		if (sampleState == NULL) return;
+
+		int32_t i = 0;
+		while (i < totalSampleNum)
+			EnsureSampleDecoded(i++);
+	}
+
+	static void LazyDecodeWorker(int32_t first)
+	{
+		int32_t i = first;
+		while (i < totalSampleNum && !lazyStop.load(std::memory_order_relaxed))
+			ClaimAndDecode(lazyOrder[i++]);
+	}
+
+	static void StopLazyDecoding()
+	{
+		if (lazyThread != NULL)
+		{
+			lazyStop = true;
+			lazyThread->join();
+			delete lazyThread;
+			lazyThread = NULL;
+		}
+
+		if (lazySource != NULL)
+		{
+#ifndef _WIN32
+			if (lazySourceMapped) munmap(lazySource, lazySourceSize);
+			else
+#endif
+			free(lazySource);
+		}
+
+		lazySource = NULL;
+		lazySourceSize = 0;
+		lazySourceMapped = false;
+		sampleJobs = NULL;
+		sampleState = NULL;
+		lazyOrder = NULL;
+	}
+
+	//Fills lazyOrder with sample numbers in order of first use in the song, unused samples last
+	//Returns how many of them are used by the first lazyOrders orders
+	static int32_t BuildLazyOrder(uint8_t *queued, uint8_t *lastInst)
+	{
+		int32_t orderNum = 0;
+		int32_t firstNum = 0;
+
+		memset(queued, 0, totalSampleNum);
+		memset(lastInst, 0, numOfChannels);
+
+		RowCache scanRow;
+		scanRow.pattern = -1;
+
+		int16_t pos = 0;
+		while (pos < songLength)
+		{
+			uint8_t pat = orderTable[pos];
+			if (pat < numOfPatterns)
+			{
+				int32_t noteNum = *(int16_t *)(patternData + patternAddr[pat]) * numOfChannels;
+				const Note *rowNotes = NULL;
+				int32_t i = 0;
+				while (i < noteNum)
+				{
+					int16_t ch = i % numOfChannels;
+					if (ch == 0) rowNotes = PatternRow(pat, i / numOfChannels, scanRow);
+
+					const Note &note = rowNotes[ch];
+					if (note.instrument) lastInst[ch] = note.instrument;
+
+					uint8_t instNum = lastInst[ch];
+					if (note.note >= 1 && note.note <= 96 && instNum >= 1 && instNum <= numOfInstruments && instruments[instNum - 1].sampleNum > 0)
+					{
+						int16_t smpNum = instruments[instNum - 1].sampleMap[note.note - 1];
+						if (smpNum >= 0 && smpNum < totalSampleNum && !queued[smpNum])
+						{
+							//Shared data is decoded with the sample holding it, which has to come first
+							const DecodeJob &job = sampleJobs[smpNum];
+							if (job.type == JOB_SAMPLE_SHARED && !queued[job.origin])
+							{
+								queued[job.origin] = 1;
+								lazyOrder[orderNum++] = job.origin;
+							}
+
+							queued[smpNum] = 1;
+							lazyOrder[orderNum++] = smpNum;
+						}
+					}
+
+					i ++;
+				}
+			}
+
+			pos ++;
+			if (pos == lazyOrders) firstNum = orderNum;
+		}
+		if (pos < lazyOrders) firstNum = orderNum;
+
+		int16_t smpNum = 0;
+		while (smpNum < totalSampleNum)
+		{
+			if (!queued[smpNum]) lazyOrder[orderNum++] = smpNum;
+			smpNum ++;
+		}
+
+		return firstNum;
+	}
+
+	//Called by LoadModule() once patterns are unpacked and sampleJobs, sampleState and lazyOrder are set up
+	//The packed samples in [source, source + sourceLeng) have to outlive the load, a mapping is taken over as is
+	static bool StartLazyDecoding(const uint8_t *source, size_t sourceLeng, void *mapping, size_t mappingSize)
+	{
+		if (mapping == NULL)
+		{
+			uint8_t *copy = (uint8_t *)malloc(sourceLeng + 1);
+			if (copy == NULL) return false;
+			memcpy(copy, source, sourceLeng);
+
+			int32_t i = 0;
+			while (i < totalSampleNum)
+			{
+				sampleJobs[i].src = copy + (sampleJobs[i].src - source);
+				i ++;
+			}
+
+			lazySource = copy;
+			lazySourceSize = sourceLeng;
+			lazySourceMapped = false;
+			LoadHold(sourceLeng);
+		}
+
+		uint8_t *scratch = (uint8_t *)malloc(totalSampleNum + numOfChannels);
+		if (scratch == NULL) return false;
+		int32_t firstNum = BuildLazyOrder(scratch, scratch + totalSampleNum);
+		free(scratch);
+
+		int32_t i = 0;
+		while (i < totalSampleNum)
+			new (&sampleState[i++]) std::atomic<uint8_t>(SAMPLE_PENDING);
+
+		//Samples needed right away are decoded here, in parallel like a normal load
+		DecodeJob *firstJobs = (DecodeJob *)malloc((firstNum + 1) * sizeof(DecodeJob));
+		if (firstJobs == NULL) return false;
+
+		int32_t workSize = 0;
+		i = 0;
+		while (i < firstNum)
+		{
+			const DecodeJob &job = sampleJobs[lazyOrder[i]];
+			firstJobs[i] = job;
+			workSize += job.type == JOB_SAMPLE_16BIT ? job.frames << 1 : job.frames;
+			i ++;
+		}
+		RunDecodeJobs(firstJobs, firstNum, workSize);
+		free(firstJobs);
+
+		i = 0;
+		while (i < firstNum)
+			sampleState[lazyOrder[i++]].store(SAMPLE_READY, std::memory_order_relaxed);
+
+		//Taken over only on success, the caller still unmaps it otherwise
+		if (mapping != NULL)
+		{
+			lazySource = mapping;
+			lazySourceSize = mappingSize;
+			lazySourceMapped = true;
+		}
+
+		if (firstNum < totalSampleNum)
+		{
+			lazyStop = false;
+			try
+			{
+				lazyThread = new std::thread(LazyDecodeWorker, firstNum);
+			}
+			catch (...)
+			{
+				//No background thread, finish the job now
+				lazyThread = NULL;
+				FinishLazyDecoding();
+			}
+		}
+
+		return true;
+	}
+
+	static size_t ArenaAlign(size_t size)
+	{
+		return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	}
+
+	//Grows the arena if needed, the contents are not kept
+	static bool ArenaReserve(size_t size)
+	{
+		if (size <= moduleArenaSize) return true;
+
+		if (moduleArena != NULL) free(moduleArena);
+		moduleArenaBase = NULL;
+		moduleArenaSize = 0;
+
+		moduleArena = (uint8_t *)malloc(size + ARENA_ALIGN);
+		if (moduleArena == NULL) return false;
+
+		moduleArenaBase = (uint8_t *)ArenaAlign((size_t)moduleArena);
+		moduleArenaSize = size;
+		return true;
+	}
+
+	static void FreeArena()
+	{
+		if (moduleArena != NULL) free(moduleArena);
+		moduleArena = NULL;
+		moduleArenaBase = NULL;
+		moduleArenaSize = 0;
+
+		if (sampleKeys != NULL) free(sampleKeys);
+		sampleKeys = NULL;
+		sampleKeyCap = 0;
+	}
+
+	static void FreeStreamBlocks();
+
+	//Module data is in the arena, in a mapped cache file (channels still in the arena),
+	//or heap allocated piece by piece by the streaming loader
+	static void FreeModuleData()
+	{
+		StopLazyDecoding();
+		streamedSamples = false;
+		hotInstReady = 0;
+
+#ifndef _WIN32
+		if (moduleMapping != NULL)
+		{
+			munmap(moduleMapping, moduleMappingSize);
+			moduleMapping = NULL;
+			moduleMappingSize = 0;
+		}
+		else
+#endif
+		if (!moduleInArena)
+		{
+			if (channels != NULL) free(channels);
+			if (instruments != NULL) free(instruments);
+			if (samples != NULL) free(samples);
+			if (patternData != NULL) free(patternData);
+			if (sampleData != NULL) free(sampleData);
+			FreeStreamBlocks();
+		}
+
+		if (blockData != NULL) free(blockData);
+		if (blockOfs != NULL) free(blockOfs);
+		if (voiceBlocks != NULL) free(voiceBlocks);
+		if (cellEvents != NULL) free(cellEvents);
+		if (rowEvents != NULL) free(rowEvents);
+		if (hotInstruments != NULL) free(hotInstruments);
+
+		channels = NULL;
+		instruments = NULL;
+		samples = NULL;
+		patternData = NULL;
+		sampleData = NULL;
+		blockData = NULL;
+		blockOfs = NULL;
+		voiceBlocks = NULL;
+		cellEvents = NULL;
+		rowEvents = NULL;
+		hotInstruments = NULL;
+		eventTableSize = 0;
+		hotInstSize = 0;
+		moduleInArena = false;
+	}
+
+#ifndef _WIN32
+	//Maps a whole file read-only, NULL if it can't be opened, is empty or is 4GB or larger
+	static void *MapFile(const char *fileName, uint32_t &fileSize, int advice)
+	{
+		int fd = open(fileName, O_RDONLY);
+		if (fd < 0) return NULL;
+
+		struct stat fileStat;
+		if (fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0 || fileStat.st_size > UINT32_MAX)
+		{
+			close(fd);
+			return NULL;
+		}
+
+		fileSize = (uint32_t)fileStat.st_size;
+		void *mapping = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapping == MAP_FAILED) return NULL;
+
+		madvise(mapping, fileSize, advice);
+		return mapping;
+	}
+#endif
+
+	//Checks every header offset against the module size before anything is sized or decoded
+	//Patterns must lie inside the data, a module cut short in the instrument block keeps the
+	//instruments whose headers are complete, truncated sample data is left to ClampSampleHeader()
+	static bool ValidateModule(const uint8_t *data, uint32_t dataLeng, uint32_t headerSize)
+	{
+		int i, j;
+
+		if (dataLeng < 80 || headerSize < 80 || !ValidSongHeader()) return false;
+		numOfInstruments = MIN(numOfInstruments, INSTRUMENTS_MAX);
+
+		uint64_t dataOfs = headerSize;
+		i = 0;
+		while (i < numOfPatterns)
+		{
+			if (dataOfs + 9 > dataLeng) return false;
+
+			uint32_t patHeaderSize = *(uint32_t *)(data + dataOfs);
+			uint16_t patternSize = *(uint16_t *)(data + dataOfs + 7);
+			if (patHeaderSize < 9 || PatternRows(data + dataOfs) < 0) return false;
+
+			dataOfs += (uint64_t)patHeaderSize + patternSize;
+			if (dataOfs > dataLeng) return false;
+			i ++;
+		}
+
+		i = 0;
+		while (i < numOfInstruments)
+		{
+			if (dataOfs + 29 > dataLeng) break;
+
+			uint32_t instSize = *(uint32_t *)(data + dataOfs);
+			int16_t instSampleNum = *(int16_t *)(data + dataOfs + 27);
+			if (instSize < 29 || instSampleNum > INST_SAMPLES_MAX) return false;
+
+			//ParseInstrument() reads the sample map and envelopes of instruments with samples
+			if (dataOfs + (instSampleNum > 0 ? MAX(instSize, 243) : instSize) > dataLeng) break;
+			dataOfs += instSize;
+
+			if (instSampleNum > 0)
+			{
+				if (dataOfs + instSampleNum * 40 > dataLeng) break;
+
+				uint64_t sampleBytes = 0;
+				j = 0;
+				while (j < instSampleNum)
+					sampleBytes += *(uint32_t *)(data + dataOfs + j++ * 40);
+
+				dataOfs += instSampleNum * 40 + sampleBytes;
+			}
+
+			i ++;
+		}
+		numOfInstruments = i;
+
+		return true;
+	}
+
+	//How the next module is stored, compressed samples are blocks of native frames with bidi loops unrolled
+	static void ApplyStorageSettings()
+	{
+		samplesCompressed = compressSamples;
+		bidiUnrolled = unrollBidiLoops || samplesCompressed;
+		sampleFormat = samplesCompressed ? (int8_t)SAMPLE_NATIVE : widenFormat;
+		patternsCompact = compactPatterns;
+		unusedPruned = pruneUnused;
+		viewRow.pattern = -1;
+	}
+
+	//mapping is the whole file mapping songDataOrig comes from (or NULL), lazy decoding keeps it instead of copying samples
+	static bool LoadModuleData(const uint8_t *songDataOrig, uint32_t songDataLeng, void *mapping)
+	{
+		//The old module is gone even if this one is rejected, nothing may play or query it
+		songLoaded = false;
+		isPlaying = false;
+		FreeModuleData();
+		ApplyStorageSettings();
+
+		int i, j;
+		int32_t songDataOfs;
+
+		//Song data is parsed in place, the caller keeps it alive during loading
+		songData = songDataOrig;
+		BeginLoadPeak(sampleKeyCap * sizeof(SampleKey));
+		LoadHold(songDataLeng);
+
+		if (songDataLeng < 80) return false;
+		int32_t HeaderSize = ParseSongHeader(songData, songDataLeng);
+
+		//Everything below can trust the header offsets
+		if (!ValidateModule(songData, songDataLeng, HeaderSize)) return false;
+		BeginLiveSet();
+
+		//Pattern data size calc
+		memset(patternAddr, 0, 256 * 4);
+		totalPatSize = 0;
+
+		//Duplicate patterns point at the first copy
+		const uint8_t *patternHeaders[256];
+		int16_t patternOrigin[256];
+
+		songDataOfs = HeaderSize;
+		int32_t patternOrig = songDataOfs;
+		i = 0;
+		while (i < numOfPatterns)
+		{
+			int32_t patHeaderSize = *(int32_t *)(songData + songDataOfs);
+			int16_t patternLeng = PatternRows(songData + songDataOfs);
+			int32_t patternSize = *(uint16_t *)(songData + songDataOfs + 7);
+
+			patternHeaders[i] = songData + songDataOfs;
+			patternOrigin[i] = liveSet.pattern[i] ? FindSharedPattern(patternHeaders, patternOrigin, i) : -1;
+
+			if (liveSet.pattern[i]) MarkLiveCells(songData + songDataOfs + patHeaderSize, patternSize, patternLeng);
+
+			songDataOfs += patHeaderSize + patternSize;
+			if (!liveSet.pattern[i]) PrunePattern(patternLeng, patternSize, true);
+
+			if (patternOrigin[i] >= 0)
+				patternAddr[i] = patternAddr[patternOrigin[i]];
+			else
+			{
+				patternAddr[i] = totalPatSize;
+				totalPatSize += PatternStorageSize(patternLeng, patternSize);
+			}
+			i ++;
+		}
+
+		//instrument size calc, sample data offsets can run past the end of a truncated module
+		totalInstSize = totalSampleSize = totalSampleNum = 0;
+		uint64_t instOrig = songDataOfs;
+		uint64_t instDataOfs = instOrig;
+		i = 0;
+		while (i < numOfInstruments)
+		{
+			uint32_t instSize = *(uint32_t *)(songData + instDataOfs);
+			int16_t instSampleNum = *(int16_t *)(songData + instDataOfs + 27);
+
+			Instrument inst;
+			ParseInstrument(songData + instDataOfs, inst, 0);
+
+			instDataOfs += instSize;
+
+			if (instSampleNum > 0)
+			{
+				uint64_t sampleDataOfs = instDataOfs + instSampleNum * 40;
+				j = 0;
+				while (j < instSampleNum)
+				{
+					const uint8_t *header = songData + instDataOfs + j * 40;
+					uint32_t available = sampleDataOfs < songDataLeng ? songDataLeng - sampleDataOfs : 0;
+
+					uint8_t sampleHeader[40];
+					ClampSampleHeader(header, sampleHeader, SampleAvailable(header, available, SampleLive(i + 1, inst, j), true));
+
+					int32_t reverseFrame;
+					int32_t frames = CalcSampleStorage(sampleHeader, reverseFrame, bidiUnrolled);
+
+					//Wider sample formats can take more than sampleData can index
+					int64_t storageBytes = SampleStorageBytes(frames, sampleHeader[14] & 0x10, sampleFormat);
+					if (storageBytes > INT32_MAX - totalSampleSize) return false;
+
+					//Duplicate samples point at the first copy
+					if (!AddSampleKey(totalSampleNum + j, sampleHeader, songData + MIN(sampleDataOfs, (uint64_t)songDataLeng))) return false;
+					if (sampleKeys[totalSampleNum + j].origin < 0) totalSampleSize += storageBytes;
+
+					sampleDataOfs += *(uint32_t *)(songData + instDataOfs + j * 40);
+					j ++;
+				}
+				instDataOfs = sampleDataOfs;
+
+				totalSampleNum += instSampleNum;
+			}
+
+			i ++;
+		}
+
+		//Arena layout, the start index table and the job list are only needed while loading
+		size_t channelsOfs = 0;
+		size_t patternDataOfs = channelsOfs + ArenaAlign(numOfChannels * sizeof(Channel));
+		size_t instrumentsOfs = patternDataOfs + ArenaAlign(totalPatSize);
+		size_t samplesOfs = instrumentsOfs + ArenaAlign(numOfInstruments * sizeof(Instrument));
+		size_t startIndexOfs = samplesOfs + ArenaAlign(totalSampleNum * sizeof(Sample));
+		size_t jobsOfs = startIndexOfs + ArenaAlign(numOfInstruments * 2);
+		size_t sampleStateOfs = jobsOfs + ArenaAlign((numOfPatterns + totalSampleNum) * sizeof(DecodeJob));
+		size_t lazyOrderOfs = sampleStateOfs + ArenaAlign(totalSampleNum * sizeof(std::atomic<uint8_t>));
+		size_t sampleDataOfs = lazyOrderOfs + ArenaAlign(totalSampleNum * 2);
+		size_t arenaSize = sampleDataOfs + (samplesCompressed ? 0 : ArenaAlign(totalSampleSize));
+
+		if (!ArenaReserve(arenaSize)) return false;
+		moduleInArena = true;
+		LoadHold(moduleArenaSize);
+
+		channels = (Channel *)(moduleArenaBase + channelsOfs);
+		patternData = moduleArenaBase + patternDataOfs;
+		instruments = (Instrument *)(moduleArenaBase + instrumentsOfs);
+		samples = (Sample *)(moduleArenaBase + samplesOfs);
+		sampleStartIndex = (int16_t *)(moduleArenaBase + startIndexOfs);
+		DecodeJob *jobs = (DecodeJob *)(moduleArenaBase + jobsOfs);
+		sampleData = (int8_t *)(moduleArenaBase + sampleDataOfs);
+
+		//Samples to be compressed are decoded outside of the arena and freed once compressed
+		if (samplesCompressed)
+		{
+			sampleData = (int8_t *)malloc(MAX(totalSampleSize, 1));
+			if (sampleData == NULL) return false;
+			LoadHold(totalSampleSize);
+		}
+
+		//The arena is reused, clear what the unpacker and the mixer expect to start zeroed
+		memset(channels, 0, numOfChannels * sizeof(Channel));
+		memset(patternData, 0, totalPatSize);
+
+		//Unpacking and delta decoding are queued here and run after all headers are parsed
+		int32_t jobNum = 0;
+
+		//Patter data
+		songDataOfs = patternOrig;
+		i = 0;
+		while (i < numOfPatterns)
+		{
+			int32_t patHeaderSize = *(int32_t *)(songData + songDataOfs);
+			int16_t patternLeng = PatternRows(songData + songDataOfs);
+			int32_t patternSize = *(uint16_t *)(songData + songDataOfs + 7);
+
+			const uint8_t *packed = songData + songDataOfs + patHeaderSize;
+			songDataOfs += patHeaderSize + patternSize;
+			if (!liveSet.pattern[i]) PrunePattern(patternLeng, patternSize, false);
+
+			if (patternOrigin[i] >= 0)
+			{
+				i ++;
+				continue;
+			}
+
+			int32_t PDIndex = patternAddr[i];
+			patternData[PDIndex++] = patternLeng & 0xFF;
+			patternData[PDIndex++] = (int8_t)((patternLeng >> 8) & 0xFF);
+
+			if (patternSize > 0)
+			{
+				DecodeJob &job = jobs[jobNum++];
+				job.type = JOB_PATTERN;
+				job.src = packed;
+				job.srcLeng = patternSize;
+				job.dst = (int8_t *)patternData + PDIndex;
+				job.frames = patternLeng;
+			}
+
+			i ++;
+		}
+
+		//Instruments and sample convert, one job per sample so sample n is jobs[patternJobNum + n]
+		int32_t patternJobNum = jobNum;
+		int32_t sampleNum = 0;
+		int32_t sampleWriteOfs = 0;
+		instDataOfs = instOrig;
+		i = 0;
+		while (i < numOfInstruments)
+		{
+			uint32_t instSize = *(uint32_t *)(songData + instDataOfs);
+			ParseInstrument(songData + instDataOfs, instruments[i], sampleNum);
+
+			int16_t instSampleNum = instruments[i].sampleNum;
+			sampleStartIndex[i] = sampleNum;
+
+			instDataOfs += instSize;
+
+			if (instSampleNum > 0)
+			{
+				uint64_t subOfs = 40 * instSampleNum;
+				j = 0;
+				while (j < instSampleNum)
+				{
+					uint64_t sampleDataOfs = instDataOfs + subOfs;
+					const uint8_t *header = songData + instDataOfs + j * 40;
+					uint32_t available = sampleDataOfs < songDataLeng ? songDataLeng - sampleDataOfs : 0;
+
+					uint8_t sampleHeader[40];
+					ClampSampleHeader(header, sampleHeader, SampleAvailable(header, available, SampleLive(i + 1, instruments[i], sampleNum), false));
+
+					Sample &smp = samples[sampleNum];
+					ParseSampleHeader(sampleHeader, smp, i + 1);
+
+					int32_t reverseFrame;
+					int32_t frames = CalcSampleStorage(sampleHeader, reverseFrame, bidiUnrolled);
+					int32_t origin = sampleKeys[sampleNum].origin;
+
+					DecodeJob &job = jobs[jobNum++];
+					job.src = songData + MIN(sampleDataOfs, (uint64_t)songDataLeng);
+					job.origin = origin;
+
+					if (origin >= 0)
+					{
+						smp.data = samples[origin].data;
+						job.type = JOB_SAMPLE_SHARED;
+						job.dst = smp.data;
+						job.frames = 0;
+					}
+					else
+					{
+						smp.data = sampleData + sampleWriteOfs + GUARD_FRAMES * SampleFrameBytes(smp.is16Bit, sampleFormat);
+
+						job.type = smp.is16Bit ? JOB_SAMPLE_16BIT : JOB_SAMPLE_8BIT;
+						job.dst = smp.data;
+						job.frames = frames;
+						job.reverseFrame = reverseFrame;
+						job.loopFrame = LoopStartFrame(sampleHeader);
+
+						sampleWriteOfs += SampleStorageBytes(frames, smp.is16Bit, sampleFormat);
+					}
+
+					subOfs += *(uint32_t *)(songData + instDataOfs + j * 40);
+					sampleNum ++;
+					j ++;
+				}
+				instDataOfs += subOfs;
+			}
+			i ++;
+		}
+
+		if (lazyOrders <= 0 || totalSampleNum == 0 || samplesCompressed)
+		{
+			//Every output offset is known now, so the jobs can run in any order
+			RunDecodeJobs(jobs, jobNum, totalPatSize + totalSampleSize);
+
+			if (samplesCompressed)
+			{
+				int32_t decodedSize = totalSampleSize;
+				bool compressed = CompressSamples();
+				free(sampleData);
+				sampleData = NULL;
+				LoadRelease(decodedSize);
+				if (!compressed) return false;
+			}
+
+			if (!CompileEvents() || !BuildHotInstruments()) return false;
+		}
+		else
+		{
+			//Patterns first, they tell which samples are needed first
+			RunDecodeJobs(jobs, patternJobNum, totalPatSize);
+			if (!CompileEvents() || !BuildHotInstruments()) return false;
+
+			sampleJobs = jobs + patternJobNum;
+			sampleState = (std::atomic<uint8_t> *)(moduleArenaBase + sampleStateOfs);
+			lazyOrder = (int16_t *)(moduleArenaBase + lazyOrderOfs);
+
+			uint32_t sourceEnd = (uint32_t)MIN(instDataOfs, (uint64_t)songDataLeng);
+			if (!StartLazyDecoding(songData + instOrig, sourceEnd - (uint32_t)instOrig, mapping, songDataLeng))
+			{
+				StopLazyDecoding();
+				return false;
+			}
+		}
+
+		sampleStartIndex = NULL;
+		songData = NULL;
+
+		ResetModule();
+		songLoaded = true;
+
+		return true;
+	}
+
+	bool LoadModule(const uint8_t *songDataOrig, uint32_t songDataLeng, bool useInterpolation = true, bool stereoEnabled = true, bool loopSong = true, int bufSize = BUFFER_SIZE, int smpRate = SMP_RATE)
+	{
+		InitSettings(useInterpolation, stereoEnabled, loopSong, bufSize, smpRate);
+		return LoadModuleData(songDataOrig, songDataLeng, NULL);
+	}
+
+	bool LoadModuleFromFile(const char *fileName, bool useInterpolation = true, bool stereoEnabled = true, bool loopSong = true, int bufSize = BUFFER_SIZE, int smpRate = SMP_RATE)
+	{
+		bool result = false;
+
+#ifndef _WIN32
+		//Map the file read-only and parse it directly, no copy of the raw module is made
+		uint32_t fileSize;
+		void *mapping = MapFile(fileName, fileSize, MADV_SEQUENTIAL);
+		if (mapping == NULL) return false;
+
+		InitSettings(useInterpolation, stereoEnabled, loopSong, bufSize, smpRate);
+		result = LoadModuleData((const uint8_t *)mapping, fileSize, mapping);
+
+		//With lazy decoding the module keeps reading samples from the mapping and unmaps it later
+		if (lazySource != mapping) munmap(mapping, fileSize);
+#else
+		FILE *file = fopen(fileName, "rb");
+		if (file == NULL) return false;
+
+		fseek(file, 0, SEEK_END);
+		long fileSize = ftell(file);
+		fseek(file, 0, SEEK_SET);
+
+		uint8_t *fileData = fileSize > 0 ? (uint8_t *)malloc(fileSize) : NULL;
+		if (fileData != NULL && fread(fileData, 1, fileSize, file) == (size_t)fileSize)
+			result = LoadModule(fileData, fileSize, useInterpolation, stereoEnabled, loopSong, bufSize, smpRate);
+
+		if (fileData != NULL) free(fileData);
+		fclose(file);
+#endif
+
+		return result;
+	}
+
+	//Streaming loader
+	//Consumes the module in file order as the bytes arrive, only headers and one packed
+	//pattern at a time are staged, sample data is delta decoded straight from the input.
+	//The song can play once the patterns are in, an instrument joins once its sample headers
+	//are parsed and each sample once its last chunk is decoded.
+
+	enum StreamState
+	{
+		STREAM_HEADER_SIZE,
+		STREAM_HEADER,
+		STREAM_PATTERN_SIZE,
+		STREAM_PATTERN_HEADER,
+		STREAM_PATTERN_DATA,
+		STREAM_INST_SIZE,
+		STREAM_INST_HEADER,
+		STREAM_SAMPLE_HEADERS,
+		STREAM_SAMPLE_DATA,
+		STREAM_DONE,
+		STREAM_ERROR
+	};
+
+	static StreamState streamState = STREAM_ERROR;
+	static uint8_t *streamBuf;
+	static int32_t streamBufSize;
+	static int32_t streamFill;
+	static int32_t streamNeed;
+	static int32_t streamBlockSize;
+	static int16_t streamIndex;
+	static int16_t streamSampleIndex;
+	static int16_t streamInstSamples;
+
+	//Allocated one at a time so nothing moves while the song plays, kept until the module is freed
+	static int8_t **streamSampleData;   //Per sample, NULL if it shares an earlier sample's data
+	static uint8_t **streamEnvValues;   //Per instrument, NULL without envelope values
+	static int32_t streamSampleCap;
+	static int16_t streamInstCap;
+
+	//Current sample being decoded
+	static int32_t streamBytesLeft;
+	static int32_t streamFramesLeft;
+	static int32_t streamFrameOfs;
+	static int32_t streamReverseFrame;
+	static int32_t streamLoopFrame;
+	static int32_t streamFrames;
+	static int16_t streamOldPt;
+	static int16_t streamOddByte;
+
+	static bool StreamReserve(int32_t size)
+	{
+		if (size <= streamBufSize) return true;
+
+		uint8_t *newBuf = (uint8_t *)realloc(streamBuf, size);
+		if (newBuf == NULL) return false;
+
+		LoadHold(size - streamBufSize);
+		streamBuf = newBuf;
+		streamBufSize = size;
+		return true;
+	}
+
+	static void StreamExpect(StreamState state, int32_t need)
+	{
+		streamState = state;
+		streamNeed = need;
+	}
+
+	static void StreamNextBlock(StreamState state, int32_t need)
+	{
+		streamFill = 0;
+		StreamExpect(state, need);
+	}
+
+	static void FreeStreamSampleData()
+	{
+		int32_t i = 0;
+		while (i < streamSampleCap)
+		{
+			if (streamSampleData[i] != NULL) free(streamSampleData[i]);
+			streamSampleData[i++] = NULL;
+		}
+	}
+
+	static void FreeStreamBlocks()
+	{
+		if (streamSampleData != NULL)
+		{
+			FreeStreamSampleData();
+			free(streamSampleData);
+		}
+
+		if (streamEnvValues != NULL)
+		{
+			int16_t i = 0;
+			while (i < streamInstCap)
+			{
+				if (streamEnvValues[i] != NULL) free(streamEnvValues[i]);
+				i ++;
+			}
+			free(streamEnvValues);
+		}
+
+		streamSampleData = NULL;
+		streamEnvValues = NULL;
+		streamSampleCap = 0;
+		streamInstCap = 0;
+	}
+
+	//Samples can't move once the song plays, there is room for as many as the instruments can have
+	//with their states after them. The hot copies are filled in as the instruments arrive.
+	static bool StreamAllocTables()
+	{
+		int32_t sampleCap = MAX(numOfInstruments, 1) * INST_SAMPLES_MAX;
+		samples = (Sample *)malloc(sampleCap * (sizeof(Sample) + sizeof(std::atomic<uint8_t>)));
+		if (samples == NULL) return false;
+		LoadHold(sampleCap * (sizeof(Sample) + sizeof(std::atomic<uint8_t>)));
+
+		streamSampleData = (int8_t **)malloc(sampleCap * sizeof(int8_t *));
+		if (streamSampleData == NULL) return false;
+		memset(streamSampleData, 0, sampleCap * sizeof(int8_t *));
+		streamSampleCap = sampleCap;
+
+		streamEnvValues = (uint8_t **)malloc(MAX(numOfInstruments, 1) * sizeof(uint8_t *));
+		if (streamEnvValues == NULL) return false;
+		memset(streamEnvValues, 0, MAX(numOfInstruments, 1) * sizeof(uint8_t *));
+		streamInstCap = numOfInstruments;
+		LoadHold(sampleCap * sizeof(int8_t *) + MAX(numOfInstruments, 1) * sizeof(uint8_t *));
+
+		hotInstSize = MAX(numOfInstruments, 1) * sizeof(HotInstrument);
+		hotInstruments = (HotInstrument *)malloc(hotInstSize);
+		if (hotInstruments == NULL) return false;
+		memset(hotInstruments, 0, hotInstSize);
+		LoadHold(hotInstSize);
+
+		sampleState = (std::atomic<uint8_t> *)(samples + sampleCap);
+		int32_t i = 0;
+		while (i < sampleCap)
+			new (&sampleState[i++]) std::atomic<uint8_t>(SAMPLE_DECODING);
+		streamedSamples = true;
+
+		return true;
+	}
+
+	static void StreamFinish()
+	{
+		free(streamBuf);
+		streamBuf = NULL;
+		LoadRelease(streamBufSize);
+		streamBufSize = 0;
+
+		if (samplesCompressed)
+		{
+			int32_t decodedSize = totalSampleSize;
+			bool compressed = CompressSamples();
+			FreeStreamSampleData();
+			LoadRelease(decodedSize);
+			if (!compressed)
+			{
+				streamState = STREAM_ERROR;
+				return;
+			}
+		}
+
+		streamState = STREAM_DONE;
+
+		//Compressed samples are only mixed once all of them are blocks, so the song starts here
+		if (samplesCompressed)
+		{
+			ResetModule();
+			songLoaded = true;
+		}
+	}
+
+	static void StreamNextInstrument()
+	{
+		streamIndex ++;
+		if (streamIndex < numOfInstruments)
+			StreamNextBlock(STREAM_INST_SIZE, 4);
+		else StreamFinish();
+	}
+
+	//Every pattern is in, the song can play from here on
+	static bool StreamPatternsDone()
+	{
+		if (!CompileEvents()) return false;
+
+		if (!samplesCompressed)
+		{
+			ResetModule();
+			songLoaded = true;
+		}
+
+		streamIndex = -1;
+		StreamNextInstrument();
+		return true;
+	}
+
+	//The instrument's header and sample headers are in, notes can use it from here on
+	static bool StreamInstrumentReady()
+	{
+		const Instrument &inst = instruments[streamIndex];
+
+		EnvTrack track;
+		uint32_t valueNum = ResolveEnvelope(inst, false, track) + ResolveEnvelope(inst, true, track);
+		if (valueNum > 0)
+		{
+			streamEnvValues[streamIndex] = (uint8_t *)malloc(valueNum);
+			if (streamEnvValues[streamIndex] == NULL) return false;
+			LoadHold(valueNum);
+			hotInstSize += valueNum;
+		}
+
+		BuildHotInstrument(streamIndex, streamEnvValues[streamIndex]);
+		hotInstReady.store(streamIndex + 1, std::memory_order_release);
+		return true;
+	}
+
+	static bool StreamNextSample()
+	{
+		if (streamSampleIndex >= streamInstSamples)
+		{
+			StreamNextInstrument();
+			return true;
+		}
+
+		int32_t sampleNum = totalSampleNum - streamInstSamples + streamSampleIndex;
+		bool is16Bit = samples[sampleNum].is16Bit;
+		bool live = SampleLive(streamIndex + 1, instruments[streamIndex], sampleNum);
+
+		uint8_t sampleHeader[40];
+		ClampSampleHeader(streamBuf + streamSampleIndex * 40, sampleHeader, SampleAvailable(streamBuf + streamSampleIndex * 40, UINT32_MAX, live, false));
+
+		//All of the sample's bytes are consumed, only the clamped length is decoded
+		streamFrames = CalcSampleStorage(sampleHeader, streamReverseFrame, bidiUnrolled);
+		streamLoopFrame = LoopStartFrame(sampleHeader);
+		streamBytesLeft = *(int32_t *)(streamBuf + streamSampleIndex * 40);
+		streamFramesLeft = streamReverseFrame >= 0 ? MIN(streamReverseFrame, streamFrames) : streamFrames;
+		streamOldPt = 0;
+		streamOddByte = -1;
+
+		if (streamBytesLeft < 0 || streamFrames < 0) return false;
+
+		//Every sample has its own block, earlier ones may be playing already
+		int64_t size = SampleStorageBytes(streamFrames, is16Bit, sampleFormat);
+		if (totalSampleSize + size > INT32_MAX) return false;
+
+		int8_t *block = (int8_t *)malloc(MAX(size, 1));
+		if (block == NULL) return false;
+		LoadHold(size);
+		streamSampleData[sampleNum] = block;
+		totalSampleSize += size;
+		samples[sampleNum].data = block + GUARD_FRAMES * SampleFrameBytes(is16Bit, sampleFormat);
+
+		//Wider formats are decoded to the end of the sample's space and widened by StreamEndSample()
+		streamFrameOfs = WidenSource(samples[sampleNum].data, streamFrames, is16Bit) - block;
+
+		streamState = STREAM_SAMPLE_DATA;
+		return true;
+	}
+
+	//A sample storing the same bytes as an earlier one points at it and frees its own block
+	static bool StreamShareSample(int32_t sampleNum, int32_t size)
+	{
+		if (!ReserveSampleKeys(sampleNum + 1)) return false;
+
+		const uint8_t *data = (const uint8_t *)streamSampleData[sampleNum];
+		SampleKey &key = sampleKeys[sampleNum];
+		key.hashed = false;
+		key.src = NULL;
+		key.layout[0] = size;
+		key.origin = -1;
+
+		int32_t k = 0;
+		while (k < sampleNum)
+		{
+			SampleKey &other = sampleKeys[k];
+			const uint8_t *otherData = (const uint8_t *)streamSampleData[k];
+			if (other.origin < 0 && other.layout[0] == (uint32_t)size
+				&& KeyHash(other, otherData) == KeyHash(key, data) && memcmp(otherData, data, size) == 0)
+			{
+				key.origin = k;
+				free(streamSampleData[sampleNum]);
+				streamSampleData[sampleNum] = NULL;
+				LoadRelease(size);
+				totalSampleSize -= size;
+				samples[sampleNum].data = streamSampleData[k] + GUARD_FRAMES * SampleFrameBytes(samples[sampleNum].is16Bit, sampleFormat);
+				break;
+			}
+			k ++;
+		}
+
+		return true;
+	}
+
+	static bool StreamEndSample()
+	{
+		int32_t sampleNum = totalSampleNum - streamInstSamples + streamSampleIndex;
+		bool is16Bit = samples[sampleNum].is16Bit;
+		int8_t *dst = samples[sampleNum].data;
+		int8_t *decodeDst = WidenSource(dst, streamFrames, is16Bit);
+
+		//Truncated sample data holds the last value
+		int32_t forwardFrames = streamReverseFrame >= 0 ? MIN(streamReverseFrame, streamFrames) : streamFrames;
+		int32_t k = forwardFrames - streamFramesLeft;
+		while (k < forwardFrames)
+		{
+			if (is16Bit) *(int16_t *)(decodeDst + (k << 1)) = streamOldPt;
+			else decodeDst[k] = streamOldPt;
+			k ++;
+		}
+
+		if (streamReverseFrame >= 0)
+			MirrorLoop(decodeDst, streamReverseFrame, streamFrames, is16Bit);
+
+		if (decodeDst != dst)
+			WidenSample(decodeDst, dst, streamFrames, is16Bit);
+
+		FillGuardFrames(dst, streamFrames, streamLoopFrame, SampleFrameBytes(is16Bit, sampleFormat));
+
+		streamSampleIndex ++;
+		if (!StreamShareSample(sampleNum, SampleStorageBytes(streamFrames, is16Bit, sampleFormat))) return false;
+
+		sampleState[sampleNum].store(SAMPLE_READY, std::memory_order_release);
+		return true;
+	}
+
+	static uint32_t StreamSampleData(const uint8_t *data, uint32_t leng)
+	{
+		int32_t sampleNum = totalSampleNum - streamInstSamples + streamSampleIndex;
+		bool is16Bit = samples[sampleNum].is16Bit;
+		uint32_t used = MIN(leng, (uint32_t)streamBytesLeft);
+		const uint8_t *src = data;
+		const uint8_t *srcEnd = data + used;
+
+		if (is16Bit)
+		{
+			//A frame split between two reads
+			if (streamOddByte >= 0 && src < srcEnd)
+			{
+				uint8_t frame[2] = { (uint8_t)streamOddByte, *src++ };
+				if (streamFramesLeft > 0)
+				{
+					DecodeDelta16(frame, streamSampleData[sampleNum] + streamFrameOfs, 1, streamOldPt);
+					streamFrameOfs += 2;
+					streamFramesLeft --;
+				}
+				streamOddByte = -1;
+			}
+
+			int32_t frames = MIN((int32_t)(srcEnd - src) >> 1, streamFramesLeft);
+			DecodeDelta16(src, streamSampleData[sampleNum] + streamFrameOfs, frames, streamOldPt);
+			streamFrameOfs += frames << 1;
+			streamFramesLeft -= frames;
+			src += frames << 1;
+
+			if (streamFramesLeft > 0 && srcEnd - src == 1)
+				streamOddByte = *src;
+		}
+		else
+		{
+			int32_t frames = MIN((int32_t)(srcEnd - src), streamFramesLeft);
+			DecodeDelta8(src, streamSampleData[sampleNum] + streamFrameOfs, frames, streamOldPt);
+			streamFrameOfs += frames;
+			streamFramesLeft -= frames;
+		}
+
+		streamBytesLeft -= used;
+		return used;
+	}
+
+	//Handles a complete staged block and sets up the next one
+	static bool StreamParseBlock()
+	{
+		switch (streamState)
+		{
+		case STREAM_HEADER_SIZE:
+			if (memcmp(streamBuf, "Extended Module: ", 17) != 0) return false;
+			streamBlockSize = *(int32_t *)(streamBuf + 60) + 60;
+			if (streamBlockSize < 80) return false;
+			StreamExpect(STREAM_HEADER, streamBlockSize);
+			break;
+
+		case STREAM_HEADER:
+			ParseSongHeader(streamBuf, streamFill);
+
+			if (!ValidSongHeader()) return false;
+			numOfInstruments = MIN(numOfInstruments, INSTRUMENTS_MAX);
+			BeginLiveSet();
+
+			channels = (Channel *)malloc(sizeof(Channel) * numOfChannels);
+			if (channels == NULL) return false;
+			memset(channels, 0, sizeof(Channel) * numOfChannels);
+
+			instruments = (Instrument *)malloc(MAX(numOfInstruments, 1) * sizeof(Instrument));
+			if (instruments == NULL) return false;
+			memset(instruments, 0, MAX(numOfInstruments, 1) * sizeof(Instrument));
+			LoadHold(sizeof(Channel) * numOfChannels + MAX(numOfInstruments, 1) * sizeof(Instrument));
+
+			if (!StreamAllocTables()) return false;
+
+			memset(patternAddr, 0, 256 * 4);
+			totalPatSize = totalInstSize = totalSampleSize = totalSampleNum = 0;
+			streamIndex = 0;
+
+			if (numOfPatterns > 0)
+				StreamNextBlock(STREAM_PATTERN_SIZE, 4);
+			else if (!StreamPatternsDone()) return false;
+			break;
+
+		case STREAM_PATTERN_SIZE:
+			streamBlockSize = *(int32_t *)(streamBuf);
+			if (streamBlockSize < 9) return false;
+			StreamExpect(STREAM_PATTERN_HEADER, streamBlockSize);
+			break;
+
+		case STREAM_PATTERN_HEADER:
+			if (PatternRows(streamBuf) < 0) return false;
+			StreamExpect(STREAM_PATTERN_DATA, streamBlockSize + *(uint16_t *)(streamBuf + 7));
+			break;
+
+		case STREAM_PATTERN_DATA:
+		{
+			int16_t patternLeng = PatternRows(streamBuf);
+			int32_t patternSize = streamNeed - streamBlockSize;
+
+			if (liveSet.pattern[streamIndex]) MarkLiveCells(streamBuf + streamBlockSize, patternSize, patternLeng);
+			else PrunePattern(patternLeng, patternSize, true);
+
+			int32_t unpackedSize = PatternStorageSize(patternLeng, patternSize);
+
+			uint8_t *newData = (uint8_t *)realloc(patternData, totalPatSize + unpackedSize);
+			if (newData == NULL) return false;
+			patternData = newData;
+			LoadHold(unpackedSize);
+
+			patternAddr[streamIndex] = totalPatSize;
+			memset(patternData + totalPatSize, 0, unpackedSize);
+			patternData[totalPatSize] = patternLeng & 0xFF;
+			patternData[totalPatSize + 1] = (patternLeng >> 8) & 0xFF;
+
+			if (patternSize > 0 && patternsCompact)
+				IndexPattern(streamBuf + streamBlockSize, patternSize, patternData + totalPatSize + 2, patternLeng);
+			else if (patternSize > 0)
+				UnpackPattern(streamBuf + streamBlockSize, patternSize, patternData + totalPatSize + 2, patternLeng);
+
+			//A copy of an earlier pattern gives its space back
+			int16_t k = 0;
+			while (k < streamIndex && (StoredPatternSize(k) != unpackedSize || memcmp(patternData + patternAddr[k], patternData + totalPatSize, unpackedSize) != 0))
+				k ++;
+
+			if (k < streamIndex)
+			{
+				patternAddr[streamIndex] = patternAddr[k];
+				LoadRelease(unpackedSize);
+			}
+			else totalPatSize += unpackedSize;
+
+			streamIndex ++;
+			if (streamIndex < numOfPatterns)
+				StreamNextBlock(STREAM_PATTERN_SIZE, 4);
+			else if (!StreamPatternsDone()) return false;
+			break;
+		}
+
+		case STREAM_INST_SIZE:
+			streamBlockSize = *(int32_t *)(streamBuf);
+			if (streamBlockSize < 29) return false;
+			StreamExpect(STREAM_INST_HEADER, streamBlockSize);
+			break;
+
+		case STREAM_INST_HEADER:
+		{
+			//Short headers read as zeros past their end
+			if (!StreamReserve(MAX(streamBlockSize, 243))) return false;
+			if (streamFill < 243) memset(streamBuf + streamFill, 0, 243 - streamFill);
+
+			ParseInstrument(streamBuf, instruments[streamIndex], totalSampleNum);
+			if (instruments[streamIndex].sampleNum > INST_SAMPLES_MAX) return false;
+
+			streamInstSamples = MAX(instruments[streamIndex].sampleNum, 0);
+			if (streamInstSamples > 0)
+				StreamNextBlock(STREAM_SAMPLE_HEADERS, streamInstSamples * 40);
+			else
+			{
+				if (!StreamInstrumentReady()) return false;
+				StreamNextInstrument();
+			}
+			break;
+		}
+
+		case STREAM_SAMPLE_HEADERS:
+		{
+			//Sample data cut short is handled by StreamEndSample()
+			int j = 0;
+			while (j < streamInstSamples)
+			{
+				bool live = SampleLive(streamIndex + 1, instruments[streamIndex], totalSampleNum + j);
+
+				uint8_t sampleHeader[40];
+				ClampSampleHeader(streamBuf + j * 40, sampleHeader, SampleAvailable(streamBuf + j * 40, UINT32_MAX, live, true));
+				ParseSampleHeader(sampleHeader, samples[totalSampleNum + j], streamIndex + 1);
+				j ++;
+			}
+
+			totalSampleNum += streamInstSamples;
+			streamSampleIndex = 0;
+
+			return StreamInstrumentReady() && StreamNextSample();
+		}
+
+		default:
+			return false;
+		}
+
+		return StreamReserve(streamNeed);
+	}
+
+	bool BeginModuleStream(bool useInterpolation = true, bool stereoEnabled = true, bool loopSong = true, int bufSize = BUFFER_SIZE, int smpRate = SMP_RATE)
+	{
+		songLoaded = false;
+		isPlaying = false;
+		InitSettings(useInterpolation, stereoEnabled, loopSong, bufSize, smpRate);
+
+		FreeModuleData();
+		ApplyStorageSettings();
+		BeginLoadPeak(sampleKeyCap * sizeof(SampleKey) + streamBufSize);
+
+		StreamNextBlock(STREAM_HEADER_SIZE, 64);
+		if (!StreamReserve(336))
+		{
+			streamState = STREAM_ERROR;
+			return false;
+		}
+
+		return true;
+	}
+
+	//Returns 1 once the module is loaded, 0 when more data is needed, -1 on error
+	//IsLoaded() is true once the patterns are in, the song can play while the rest is fed
+	int8_t FeedModuleStream(const uint8_t *data, uint32_t leng)
+	{
+		while (true)
+		{
+			if (streamState == STREAM_DONE) return 1;
+			if (streamState == STREAM_ERROR) return -1;
+
+			if (streamState == STREAM_SAMPLE_DATA)
+			{
+				if (streamBytesLeft == 0)
+				{
+					if (!StreamEndSample() || !StreamNextSample()) streamState = STREAM_ERROR;
+					continue;
+				}
+				if (leng == 0) return 0;
+
+				uint32_t used = StreamSampleData(data, leng);
+				data += used;
+				leng -= used;
+				continue;
+			}
+
+			if (streamFill < streamNeed)
+			{
+				if (leng == 0) return 0;
+
+				uint32_t copyLeng = MIN(leng, (uint32_t)(streamNeed - streamFill));
+				memcpy(streamBuf + streamFill, data, copyLeng);
+				streamFill += copyLeng;
+				data += copyLeng;
+				leng -= copyLeng;
+				continue;
+			}
+
+			if (!StreamParseBlock()) streamState = STREAM_ERROR;
+		}
+	}
+
+#ifndef _WIN32
+	bool LoadModuleFromFd(int fd, bool useInterpolation = true, bool stereoEnabled = true, bool loopSong = true, int bufSize = BUFFER_SIZE, int smpRate = SMP_RATE)
+	{
+		if (!BeginModuleStream(useInterpolation, stereoEnabled, loopSong, bufSize, smpRate))
+			return false;
+
+		uint8_t chunk[65536];
+		int8_t result = 0;
+		while (result == 0)
+		{
+			ssize_t readLeng = read(fd, chunk, sizeof(chunk));
+			if (readLeng < 0 && errno == EINTR) continue;
+			if (readLeng <= 0) break;
+
+			result = FeedModuleStream(chunk, readLeng);
+		}
+
+		return result == 1;
+	}
+#endif
+
+	//Hash used to key cache files (and by the module indexer)
+	//FNV style multiply per 8 byte word in 8 independent lanes so it keeps up with the decoder,
+	//the lanes are mixed together at the end
+	uint64_t HashModule(const uint8_t *data, uint32_t dataLeng)
+	{
+		uint64_t lanes[8];
+		uint32_t i = 0;
+		int k;
+
+		k = 0;
+		while (k < 8)
+		{
+			lanes[k] = 14695981039346656037ULL + k * 0x9E3779B97F4A7C15ULL;
+			k ++;
+		}
+
+		while (i + 64 <= dataLeng)
+		{
+			k = 0;
+			while (k < 8)
+			{
+				uint64_t word;
+				memcpy(&word, data + i + k * 8, 8);
+				lanes[k] = (lanes[k] ^ word) * 1099511628211ULL;
+				k ++;
+			}
+			i += 64;
+		}
+
+		uint64_t hash = 14695981039346656037ULL;
+		k = 0;
+		while (k < 8)
+		{
+			hash = (hash ^ lanes[k] ^ (lanes[k] >> 29)) * 1099511628211ULL;
+			hash ^= hash >> 32;
+			k ++;
+		}
+
+		while (i < dataLeng)
+			hash = (hash ^ data[i++]) * 1099511628211ULL;
+
+		return hash ^ dataLeng;
+	}
+
+#ifndef _WIN32
+	//Decoded module cache
+	//The header is followed by the instrument table, the sample table, patternData and sampleData,
+	//each starting on a CACHE_ALIGN boundary and laid out exactly as the engine uses them.
+	//Sample data pointers are stored as offsets into sampleData and fixed up after mapping.
+
+	struct CacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t structSizes;
+		uint32_t sourceLeng;
+		uint64_t sourceHash;
+
+		uint32_t instrumentsOfs;
+		uint32_t samplesOfs;
+		uint32_t patternDataOfs;
+		uint32_t sampleDataOfs;
+		uint32_t fileSize;
+
+		char songName[21];
+		char trackerName[21];
+		int16_t trackerVersion;
+		int16_t songLength;
+		int16_t rstPos;
+		int16_t numOfChannels;
+		int16_t numOfPatterns;
+		int16_t numOfInstruments;
+		int16_t defaultSpd;
+		int16_t defaultTempo;
+		bool useAmigaFreqTable;
+		bool bidiUnrolled;
+		int8_t sampleFormat;
+		bool patternsCompact;
+		bool unusedPruned;
+		int32_t prunedSize;
+		uint8_t orderTable[256];
+		int32_t patternAddr[256];
+		int32_t totalPatSize;
+		int32_t totalInstSize;
+		int32_t totalSampleSize;
+		int32_t totalSampleNum;
+	};
+
+	static uint32_t CacheAlign(uint32_t ofs)
+	{
+		return (ofs + CACHE_ALIGN - 1) & ~(uint32_t)(CACHE_ALIGN - 1);
+	}
+
+	static bool WriteCacheBlock(FILE *file, const void *data, uint32_t leng, uint32_t ofs)
+	{
+		static const uint8_t zeros[CACHE_ALIGN] = {0};
+
+		long pos = ftell(file);
+		if (pos < 0 || (uint32_t)pos > ofs) return false;
+
+		uint32_t gap = ofs - (uint32_t)pos;
+		if (gap > 0 && fwrite(zeros, 1, gap, file) != gap) return false;
+
+		return leng == 0 || fwrite(data, 1, leng, file) == leng;
+	}
+
+	//Writes the currently loaded module, the file is replaced atomically so concurrent readers never see a partial cache
+	static bool SaveModuleCache(const char *cacheFile, uint64_t sourceHash, uint32_t sourceLeng)
+	{
+		FinishLazyDecoding();
+
+		CacheHeader header;
+		memset(&header, 0, sizeof(CacheHeader));
+		memcpy(header.magic, "GXMC", 4);
+		header.version = CACHE_VERSION;
+		header.structSizes = (sizeof(Instrument) << 16) | sizeof(Sample);
+		header.sourceLeng = sourceLeng;
+		header.sourceHash = sourceHash;
+
+		memcpy(header.songName, songName, 21);
+		memcpy(header.trackerName, trackerName, 21);
+		header.trackerVersion = trackerVersion;
+		header.songLength = songLength;
+		header.rstPos = rstPos;
+		header.numOfChannels = numOfChannels;
+		header.numOfPatterns = numOfPatterns;
+		header.numOfInstruments = numOfInstruments;
+		header.defaultSpd = defaultSpd;
+		header.defaultTempo = defaultTempo;
+		header.useAmigaFreqTable = useAmigaFreqTable;
+		header.bidiUnrolled = bidiUnrolled;
+		header.sampleFormat = sampleFormat;
+		header.patternsCompact = patternsCompact;
+		header.unusedPruned = unusedPruned;
+		header.prunedSize = prunedSize;
+		memcpy(header.orderTable, orderTable, 256);
+		memcpy(header.patternAddr, patternAddr, 256 * 4);
+		header.totalPatSize = totalPatSize;
+		header.totalInstSize = totalInstSize;
+		header.totalSampleSize = totalSampleSize;
+		header.totalSampleNum = totalSampleNum;
+
+		uint32_t instrumentsLeng = numOfInstruments * sizeof(Instrument);
+		uint32_t samplesLeng = totalSampleNum * sizeof(Sample);
+		header.instrumentsOfs = CacheAlign(sizeof(CacheHeader));
+		header.samplesOfs = CacheAlign(header.instrumentsOfs + instrumentsLeng);
+		header.patternDataOfs = CacheAlign(header.samplesOfs + samplesLeng);
+		header.sampleDataOfs = CacheAlign(header.patternDataOfs + totalPatSize);
+		header.fileSize = header.sampleDataOfs + totalSampleSize;
+
+		Sample *sampleTable = (Sample *)malloc(samplesLeng + 1);
+		if (sampleTable == NULL) return false;
+
+		int32_t i = 0;
+		while (i < totalSampleNum)
+		{
+			sampleTable[i] = samples[i];
+			sampleTable[i].data = (int8_t *)(intptr_t)(samples[i].data - sampleData);
+			i ++;
+		}
+
+		size_t tmpLeng = strlen(cacheFile) + 24;
+		char *tmpFile = (char *)malloc(tmpLeng);
+		if (tmpFile == NULL)
+		{
+			free(sampleTable);
+			return false;
+		}
+		snprintf(tmpFile, tmpLeng, "%s.%d.tmp", cacheFile, (int)getpid());
+
+		bool result = false;
+		FILE *file = fopen(tmpFile, "wb");
+		if (file != NULL)
+		{
+			result = WriteCacheBlock(file, &header, sizeof(CacheHeader), 0)
+				&& WriteCacheBlock(file, instruments, instrumentsLeng, header.instrumentsOfs)
+				&& WriteCacheBlock(file, sampleTable, samplesLeng, header.samplesOfs)
+				&& WriteCacheBlock(file, patternData, totalPatSize, header.patternDataOfs)
+				&& WriteCacheBlock(file, sampleData, totalSampleSize, header.sampleDataOfs);
+
+			if (fclose(file) != 0) result = false;
+			if (result) result = rename(tmpFile, cacheFile) == 0;
+			if (!result) unlink(tmpFile);
+		}
+
+		free(tmpFile);
+		free(sampleTable);
+		return result;
+	}
+
+	//A cache file whose header matches can still be cut short or corrupted, so every table playback indexes
+	//is held to what ParseSongHeader(), ValidateModule(), ClampSampleHeader() and ClampEnvelope() give a module
+	static bool ValidCacheTables(const CacheHeader *header, uint8_t *data)
+	{
+		int32_t i, j;
+
+		if (header->numOfInstruments > INSTRUMENTS_MAX || header->totalPatSize < 0 || header->totalSampleSize < 0) return false;
+		if (header->songLength < 1 || header->songLength > 256 || header->rstPos < 0 || header->rstPos >= header->songLength) return false;
+
+		i = 0;
+		while (i < 256)
+		{
+			if (header->orderTable[i] >= header->numOfPatterns) return false;
+			i ++;
+		}
+
+		const uint8_t *pats = data + header->patternDataOfs;
+		i = 0;
+		while (i < header->numOfPatterns)
+		{
+			int64_t addr = header->patternAddr[i];
+			if (addr < 0 || addr + 4 > header->totalPatSize) return false;
+
+			int16_t patternLeng = *(const int16_t *)(pats + addr);
+			if (patternLeng <= 0 || patternLeng > 256) return false;
+
+			int64_t patternEnd = header->patternsCompact
+				? addr + 4 + patternLeng * 2 + *(const uint16_t *)(pats + addr + 2)
+				: addr + 2 + (int64_t)patternLeng * NOTE_SIZE_XM * header->numOfChannels;
+			if (patternEnd > header->totalPatSize) return false;
+
+			//UnpackNote() empties notes past key off, compact rows go through it again when played
+			if (!header->patternsCompact)
+			{
+				const uint8_t *note = pats + addr + 2;
+				while (note < pats + patternEnd)
+				{
+					if (*note > 97) return false;
+					note += NOTE_SIZE_XM;
+				}
+			}
+			i ++;
+		}
+
+		Instrument *insts = (Instrument *)(data + header->instrumentsOfs);
+		i = 0;
+		while (i < header->numOfInstruments)
+		{
+			Instrument &inst = insts[i];
+			if (inst.sampleNum < 0 || inst.sampleNum > INST_SAMPLES_MAX) return false;
+
+			j = 0;
+			while (j < 96)
+			{
+				if (inst.sampleMap[j] < -1 || inst.sampleMap[j] >= header->totalSampleNum) return false;
+				j ++;
+			}
+
+			ClampEnvelope(inst.volEnvelops, inst.volPoints, inst.volSustainPt, inst.volLoopStart, inst.volLoopEnd, inst.volType);
+			ClampEnvelope(inst.panEnvelops, inst.panPoints, inst.panSustainPt, inst.panLoopStart, inst.panLoopEnd, inst.panType);
+			i ++;
+		}
+
+		//Sample data pointers are still offsets into sampleData here
+		const Sample *smps = (const Sample *)(data + header->samplesOfs);
+		i = 0;
+		while (i < header->totalSampleNum)
+		{
+			const Sample &smp = smps[i];
+			int32_t frameBytes = SampleFrameBytes(smp.is16Bit, header->sampleFormat);
+
+			if (smp.type < 0 || smp.type > 3 || smp.origInst < 1 || smp.origInst > header->numOfInstruments) return false;
+			if (smp.length < 0 || smp.length > SAMPLE_BYTES_MAX / (smp.is16Bit ? 2 : 1)) return false;
+			if (smp.loopStart < 0 || smp.loopLength < 0 || smp.loopStart > smp.length || smp.loopLength > smp.length - smp.loopStart) return false;
+			if (smp.type != 0 && smp.loopLength == 0) return false;
+
+			int32_t frames = smp.type == 0 ? smp.length : smp.loopStart + smp.loopLength;
+			if (smp.type >= 2 && header->bidiUnrolled) frames += smp.loopLength;
+
+			intptr_t dataOfs = (intptr_t)smp.data;
+			if (dataOfs < GUARD_FRAMES * frameBytes || dataOfs + (int64_t)(frames + GUARD_FRAMES) * frameBytes > header->totalSampleSize) return false;
+			i ++;
+		}
+
+		return true;
+	}
+
+	//Maps a cache file and points the engine straight at it, false if it is missing, stale, from another build or damaged
+	static bool LoadModuleCache(const char *cacheFile, uint64_t sourceHash, uint32_t sourceLeng)
+	{
+		int fd = open(cacheFile, O_RDONLY);
+		if (fd < 0) return false;
+
+		struct stat fileStat;
+		if (fstat(fd, &fileStat) != 0 || fileStat.st_size < (off_t)sizeof(CacheHeader) || fileStat.st_size > UINT32_MAX)
+		{
+			close(fd);
+			return false;
+		}
+
+		//Private writable mapping, only the sample table page(s) get copied by the pointer fix-up
+		size_t mappingSize = fileStat.st_size;
+		void *mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapping == MAP_FAILED) return false;
+
+		uint8_t *data = (uint8_t *)mapping;
+		const CacheHeader *header = (const CacheHeader *)data;
+
+		bool valid = memcmp(header->magic, "GXMC", 4) == 0
+			&& header->version == CACHE_VERSION
+			&& header->structSizes == ((sizeof(Instrument) << 16) | sizeof(Sample))
+			&& header->sourceHash == sourceHash
+			&& header->sourceLeng == sourceLeng
+			&& header->bidiUnrolled == unrollBidiLoops
+			&& header->sampleFormat == widenFormat
+			&& header->patternsCompact == compactPatterns
+			&& header->unusedPruned == pruneUnused
+			&& header->fileSize == mappingSize
+			&& header->numOfChannels > 0 && header->numOfChannels <= CHANNELS_MAX
+			&& header->numOfPatterns > 0 && header->numOfPatterns <= 256
+			&& header->numOfInstruments >= 0
+			&& header->totalSampleNum >= 0
+			&& header->instrumentsOfs + (uint64_t)header->numOfInstruments * sizeof(Instrument) <= header->samplesOfs
+			&& header->samplesOfs + (uint64_t)header->totalSampleNum * sizeof(Sample) <= header->patternDataOfs
+			&& header->patternDataOfs + (uint64_t)header->totalPatSize <= header->sampleDataOfs
+			&& header->sampleDataOfs + (uint64_t)header->totalSampleSize <= mappingSize
+			&& ValidCacheTables(header, data);
+
+		if (!valid)
+		{
+			munmap(mapping, mappingSize);
+			return false;
+		}
+
+		//Channels are the only part that is not in the cache file
+		FreeModuleData();
+		if (!ArenaReserve(header->numOfChannels * sizeof(Channel)))
+		{
+			munmap(mapping, mappingSize);
+			return false;
+		}
+		moduleInArena = true;
+
+		//The module file stays mapped while its cache is loaded
+		BeginLoadPeak(sampleKeyCap * sizeof(SampleKey));
+		LoadHold(sourceLeng + mappingSize + moduleArenaSize);
+		channels = (Channel *)moduleArenaBase;
+		memset(channels, 0, header->numOfChannels * sizeof(Channel));
+
+		moduleMapping = mapping;
+		moduleMappingSize = mappingSize;
+
+		memcpy(songName, header->songName, 21);
+		memcpy(trackerName, header->trackerName, 21);
+		trackerVersion = header->trackerVersion;
+		songLength = header->songLength;
+		rstPos = header->rstPos;
+		numOfChannels = header->numOfChannels;
+		numOfPatterns = header->numOfPatterns;
+		numOfInstruments = header->numOfInstruments;
+		defaultSpd = header->defaultSpd;
+		defaultTempo = header->defaultTempo;
+		useAmigaFreqTable = header->useAmigaFreqTable;
+		bidiUnrolled = header->bidiUnrolled;
+		sampleFormat = header->sampleFormat;
+		samplesCompressed = false;
+		patternsCompact = header->patternsCompact;
+		unusedPruned = header->unusedPruned;
+		prunedSize = header->prunedSize;
+		viewRow.pattern = -1;
+		memcpy(orderTable, header->orderTable, 256);
+		memcpy(patternAddr, header->patternAddr, 256 * 4);
+		totalPatSize = header->totalPatSize;
+		totalInstSize = header->totalInstSize;
+		totalSampleSize = header->totalSampleSize;
+		totalSampleNum = header->totalSampleNum;
+
+		instruments = (Instrument *)(data + header->instrumentsOfs);
+		samples = (Sample *)(data + header->samplesOfs);
+		patternData = data + header->patternDataOfs;
+		sampleData = (int8_t *)(data + header->sampleDataOfs);
+
+		int32_t i = 0;
+		while (i < totalSampleNum)
+		{
+			samples[i].data = sampleData + (intptr_t)samples[i].data;
+			i ++;
+		}
+
+		return CompileEvents() && BuildHotInstruments();
+	}
+
+	//Loads through a cache of decoded modules in cacheDir, keyed by the hash of the file contents
+	//A missing or stale cache entry is rebuilt from the module after a normal load
+	bool LoadModuleCached(const char *fileName, const char *cacheDir, bool useInterpolation = true, bool stereoEnabled = true, bool loopSong = true, int bufSize = BUFFER_SIZE, int smpRate = SMP_RATE)
+	{
+		uint32_t fileSize;
+		void *mapping = MapFile(fileName, fileSize, MADV_SEQUENTIAL);
+		if (mapping == NULL) return false;
+
+		uint64_t hash = HashModule((const uint8_t *)mapping, fileSize);
+
+		size_t cacheFileLeng = strlen(cacheDir) + 24;
+		char *cacheFile = (char *)malloc(cacheFileLeng);
+		if (cacheFile == NULL)
+		{
+			munmap(mapping, fileSize);
+			return false;
+		}
+		snprintf(cacheFile, cacheFileLeng, "%s/%016llx.gxc", cacheDir, (unsigned long long)hash);
+
+		bool result;
+		songLoaded = false;
+		isPlaying = false;
+		//Compressed samples are never cached, the cache is for loading decoded samples without work
+		if (!compressSamples && LoadModuleCache(cacheFile, hash, fileSize))
+		{
+			InitSettings(useInterpolation, stereoEnabled, loopSong, bufSize, smpRate);
+			ResetModule();
+			songLoaded = true;
+			result = true;
+		}
+		else
+		{
+			result = LoadModule((const uint8_t *)mapping, fileSize, useInterpolation, stereoEnabled, loopSong, bufSize, smpRate);
+			if (result && !samplesCompressed) SaveModuleCache(cacheFile, hash, fileSize);
+		}
+
+		free(cacheFile);
+		munmap(mapping, fileSize);
+		return result;
+	}
+#endif
+
+	//Header-only parsing, nothing is decoded and no engine state is touched
+	//Returns false if the data is not an XM module or any header lies outside of it
+	bool ProbeModule(const uint8_t *data, uint32_t dataLeng, ModuleInfo *info)
+	{
+		int i, j;
+
+		if (dataLeng < 80 || memcmp(data, "Extended Module: ", 17) != 0) return false;
+
+		memset(info, 0, sizeof(ModuleInfo));
+		memcpy(info->songName, data + 17, 20);
+		memcpy(info->trackerName, data + 38, 20);
+		info->trackerVersion = (((((uint16_t)data[58]) << 8) & 0xFF00) | data[59]);
+
+		uint32_t headerSize = *(uint32_t *)(data + 60) + 60;
+		info->songLength = *(int16_t *)(data + 64);
+		info->rstPos = *(int16_t *)(data + 66);
+		info->numOfChannels = *(int16_t *)(data + 68);
+		info->numOfPatterns = *(int16_t *)(data + 70);
+		info->numOfInstruments = *(int16_t *)(data + 72);
+		info->useAmigaFreqTable = !(data[74] & 1);
+		info->defaultSpd = *(int16_t *)(data + 76);
+		info->defaultTempo = *(int16_t *)(data + 78);
+
+		if (info->numOfChannels <= 0 || info->numOfChannels > CHANNELS_MAX || info->numOfPatterns <= 0 || info->numOfPatterns > 256 || info->numOfInstruments < 0) return false;
+		info->numOfInstruments = MIN(info->numOfInstruments, INSTRUMENTS_MAX);
+
+		i = 0;
+		while (i < info->songLength && i < 256 && 80 + i < (int32_t)dataLeng)
+		{
+			info->orderTable[i] = data[80 + i];
+			i ++;
+		}
+
+		//Pattern headers
+		uint64_t dataOfs = headerSize;
+		i = 0;
+		while (i < info->numOfPatterns)
+		{
+			if (dataOfs + 9 > dataLeng) return false;
+
+			uint32_t patHeaderSize = *(uint32_t *)(data + dataOfs);
+			int16_t patternLeng = PatternRows(data + dataOfs);
+			uint16_t patternSize = *(uint16_t *)(data + dataOfs + 7);
+			if (patternLeng < 0) return false;
+
+			info->totalRows += patternLeng;
+			info->patternDataSize += 2 + patternLeng * NOTE_SIZE_XM * info->numOfChannels;
+
+			dataOfs += (uint64_t)patHeaderSize + patternSize;
+			i ++;
+		}
+
+		//Instrument and sample headers, sample data is skipped
+		i = 0;
+		while (i < info->numOfInstruments)
+		{
+			if (dataOfs + 29 > dataLeng) return false;
+
+			uint32_t instSize = *(uint32_t *)(data + dataOfs);
+			int16_t instSampleNum = *(int16_t *)(data + dataOfs + 27);
+			if (instSize < 29 || instSampleNum > INST_SAMPLES_MAX) return false;
+
+			dataOfs += instSize;
+
+			if (instSampleNum > 0)
+			{
+				if (dataOfs + instSampleNum * 40 > dataLeng) return false;
+
+				uint64_t sampleBytes = 0;
+				j = 0;
+				while (j < instSampleNum)
+				{
+					uint64_t sampleDataOfs = dataOfs + instSampleNum * 40 + sampleBytes;
+					uint8_t sampleHeader[40];
+					ClampSampleHeader(data + dataOfs + j * 40, sampleHeader, sampleDataOfs < dataLeng ? dataLeng - sampleDataOfs : 0);
+
+					int32_t reverseFrame;
+					int32_t frames = CalcSampleStorage(sampleHeader, reverseFrame, unrollBidiLoops);
+
+					sampleBytes += *(uint32_t *)(data + dataOfs + j * 40);
+					info->decodedSampleSize += SampleStorageBytes(frames, sampleHeader[14] & 0x10, widenFormat);
+					info->int16SampleSize += SampleStorageBytes(frames, sampleHeader[14] & 0x10, SAMPLE_INT16);
+					info->floatSampleSize += SampleStorageBytes(frames, sampleHeader[14] & 0x10, SAMPLE_FLOAT);
+					j ++;
+				}
+
+				info->numOfSamples += instSampleNum;
+				info->sampleDataSize += sampleBytes;
+				dataOfs += instSampleNum * 40 + sampleBytes;
+			}
+
+			i ++;
+		}
+
+		return dataOfs <= dataLeng;
+	}
+
+	bool ProbeModuleFromFile(const char *fileName, ModuleInfo *info)
+	{
+		bool result = false;
+
+#ifndef _WIN32
+		//Only the header pages of the mapping are ever touched
+		uint32_t fileSize;
+		void *mapping = MapFile(fileName, fileSize, MADV_RANDOM);
+		if (mapping == NULL) return false;
+
+		result = ProbeModule((const uint8_t *)mapping, fileSize, info);
+
+		munmap(mapping, fileSize);
+#else
+		FILE *file = fopen(fileName, "rb");
+		if (file == NULL) return false;
+
+		fseek(file, 0, SEEK_END);
+		long fileSize = ftell(file);
+		fseek(file, 0, SEEK_SET);
+
+		uint8_t *fileData = fileSize > 0 ? (uint8_t *)malloc(fileSize) : NULL;
+		if (fileData != NULL && fread(fileData, 1, fileSize, file) == (size_t)fileSize)
+			result = ProbeModule(fileData, fileSize, info);
+
+		if (fileData != NULL) free(fileData);
+		fclose(file);
+#endif
+
+		return result;
 	}
 
-	static EnvInfo CalcEnvelope(Instrument inst, int16_t pos, bool calcPan)
+	static EnvInfo CalcEnvelope(const Instrument &inst, int16_t pos, bool calcPan)
 	{
 		EnvInfo retInfo;
 
 		if (inst.sampleNum > 0)
 		{
-			int16_t *envData = calcPan ? inst.panEnvelops : inst.volEnvelops;
+			const int16_t *envData = calcPan ? inst.panEnvelops : inst.volEnvelops;
 			int8_t numOfPoints = calcPan ? inst.panPoints : inst.volPoints;
 			retInfo.maxPoint = envData[(numOfPoints - 1) * 2];
 
@@ -986,7 +4071,32 @@ namespace GXMPlayer
 		return retInfo;
 	}
 
-#define PI 3.1415926535897932384626433832795
+	//Value of an envelope at pos, looked up when it is rasterised
+	static uint8_t EnvelopeValue(const EnvTrack &track, const Instrument &inst, int16_t pos, bool calcPan)
+	{
+		if (track.values != NULL && pos >= 0) return track.values[MIN(pos, track.end)];
+		return CalcEnvelope(inst, pos, calcPan).value;
+	}
+
+	//Moves an envelope on by a tick, holding at the sustain point until the note fades and wrapping loops
+	static void AdvanceEnvelope(const EnvTrack &track, int8_t type, bool fading, int16_t &pos)
+	{
+		if (type & 0x02)
+		{
+			if (pos != track.sustain || fading)
+				pos ++;
+		}
+		else pos ++;
+
+		if (type & 0x04)
+		{
+			if (pos >= track.loopEnd)
+				pos = track.loopStart;
+		}
+
+		if (pos >= track.end)
+			pos = track.end;
+	}
 
 	static void CalcPeriod(uint8_t i)
 	{
@@ -995,6 +4105,12 @@ namespace GXMPlayer
 		int16_t period;
 		if (!useAmigaFreqTable)
 			period = 7680 - realNote * 64 - fineTune / 2;
+		else if (realNote >= 0)
+		{
+			int16_t octave = realNote / 12;
+			int16_t octavePeriod = amigaPeriodTab[(realNote % 12) * 256 + fineTune + 128];
+			period = octave <= 5 ? octavePeriod << (5 - octave) : octavePeriod >> (octave - 5);
+		}
 		else
 		{
 			//https://github.com/dodocloud/xmplayer/blob/master/src/xmlib/engine/utils.ts
@@ -1017,9 +4133,14 @@ namespace GXMPlayer
 
 	static void UpdateChannelInfo()
 	{
+		uint8_t allDirty = (channelsDirty ? CH_DIRTY_ALL : 0) | (globalVol != updateGlobalVol ? CH_DIRTY_VOLUME : 0);
+		channelsDirty = false;
+		updateGlobalVol = globalVol;
+
 		int i = 0;
 		while (i < numOfChannels)
 		{
+			Ch.dirty |= allDirty;
 			if (Ch.active && Ch.samplePlaying != -1)
 			{
 				//arpeggio
@@ -1030,240 +4151,258 @@ namespace GXMPlayer
 					int8_t arpeggio[3] = { 0, arpNote2, arpNote1 };
 					if (useAmigaFreqTable) Ch.noteArpeggio = Ch.note + arpeggio[tick % 3];
 					else Ch.periodOfs = -arpeggio[tick % 3] * 64;
+					Ch.dirty |= CH_DIRTY_PERIOD;
 					//Ch.period = Ch.targetPeriod;
 				}
 
-				//Auto vibrato
+				//Auto vibrato, the playing sample always belongs to an instrument with samples
 				int32_t autoVibFinal = 0;
-				if (Ch.samplePlaying != -1)
-				{
-					Instrument smpOrigInst = instruments[samples[Ch.samplePlaying].origInst - 1];
+				const HotInstrument &smpOrigInst = hotInstruments[samples[Ch.samplePlaying].origInst - 1];
 
-					if (smpOrigInst.sampleNum > 0)
-					{
-						Ch.autoVibPos += smpOrigInst.vibratoRate;
-						if (Ch.autoVibSweep < smpOrigInst.vibratoSweep) Ch.autoVibSweep ++;
-
-						if (smpOrigInst.vibratoRate)
-						{
-							//https://github.com/milkytracker/MilkyTracker/blob/master/src/milkyplay/PlayerSTD.cpp
-							//Line 568 - 599
-							uint8_t vibPos = Ch.autoVibPos >> 2;
-							uint8_t vibDepth = smpOrigInst.vibratoDepth;
-
-							int32_t value = 0;
-							switch (smpOrigInst.vibratoType) {
-								// sine (we must invert the phase here)
-							case 0:
-								value = ~vibTab[vibPos & 31];
-								break;
-								// square
-							case 1:
-								value = 255;
-								break;
-								// ramp down (down being the period here - so ramp frequency up ;)
-							case 2:
-								value = ((vibPos & 31) * 539087) >> 16;
-								if ((vibPos & 63) > 31) value = 255 - value;
-								break;
-								// ramp up (up being the period here - so ramp frequency down ;)
-							case 3:
-								value = ((vibPos & 31) * 539087) >> 16;
-								if ((vibPos & 63) > 31) value = 255 - value;
-								value = -value;
-								break;
-							}
+				Ch.autoVibPos += smpOrigInst.vibratoRate;
+				if (Ch.autoVibSweep < smpOrigInst.vibratoSweep) Ch.autoVibSweep ++;
 
-							autoVibFinal = ((value * vibDepth) >> 1);
-							if (smpOrigInst.vibratoSweep) {
-								autoVibFinal *= ((int32_t)Ch.autoVibSweep << 8) / smpOrigInst.vibratoSweep;
-								autoVibFinal >>= 8;
-							}
-
-							if ((vibPos & 63) > 31) autoVibFinal = -autoVibFinal;
-
-							autoVibFinal >>= 7;
-						}
+				if (smpOrigInst.vibratoRate)
+				{
+					//https://github.com/milkytracker/MilkyTracker/blob/master/src/milkyplay/PlayerSTD.cpp
+					//Line 568 - 599
+					uint8_t vibPos = Ch.autoVibPos >> 2;
+					uint8_t vibDepth = smpOrigInst.vibratoDepth;
+					if (vibDepth) Ch.dirty |= CH_DIRTY_PERIOD;
+
+					int32_t value = 0;
+					switch (smpOrigInst.vibratoType) {
+						// sine (we must invert the phase here)
+					case 0:
+						value = ~vibTab[vibPos & 31];
+						break;
+						// square
+					case 1:
+						value = 255;
+						break;
+						// ramp down (down being the period here - so ramp frequency up ;)
+					case 2:
+						value = ((vibPos & 31) * 539087) >> 16;
+						if ((vibPos & 63) > 31) value = 255 - value;
+						break;
+						// ramp up (up being the period here - so ramp frequency down ;)
+					case 3:
+						value = ((vibPos & 31) * 539087) >> 16;
+						if ((vibPos & 63) > 31) value = 255 - value;
+						value = -value;
+						break;
 					}
-				}
 
-				//delta calculation
-				CalcPeriod(i);
-				double freq;
-				double realPeriod = MAX(Ch.period + Ch.periodOfs, 50) + Ch.vibratoAmp * sin((Ch.vibratoPos & 0x3F) * PI / 32) * 8 + autoVibFinal;
-				if (!useAmigaFreqTable)
-					freq = 8363 * pow(2, (4608 - realPeriod) / 768);
-				else freq = 8363.0 * 1712 / realPeriod;
+					autoVibFinal = ((value * vibDepth) >> 1);
+					if (smpOrigInst.vibratoSweep) {
+						autoVibFinal *= ((int32_t)Ch.autoVibSweep << 8) / smpOrigInst.vibratoSweep;
+						autoVibFinal >>= 8;
+					}
 
-				Ch.delta = (uint32_t)(freq / sampleRate * TOINT_SCL);
+					if ((vibPos & 63) > 31) autoVibFinal = -autoVibFinal;
 
-				Instrument Inst = instruments[Ch.instrument - 1];
+					autoVibFinal >>= 7;
+				}
 
-				//volume
-				Ch.volume = MAX(MIN(Ch.volume, 64), 0);
-				int16_t realVol = Ch.tremorMute ? 0 : (int8_t)MAX(MIN(Ch.volume + Ch.tremorAmp * sin((Ch.tremorPos & 0x3F) * PI / 32) * 4, 64), 0);
-				int16_t volTarget = realVol * globalVol / 64;
-				if (Inst.volType & 0x01)
+				//delta calculation, only when the period or what moves it changed
+				if (Ch.dirty & CH_DIRTY_PERIOD)
 				{
-					EnvInfo volEnv = CalcEnvelope(Inst, Ch.volEnvelope, false);
+					CalcPeriod(i);
+					double realPeriod = MAX(Ch.period + Ch.periodOfs, 50) + Ch.vibratoAmp * sineTab[Ch.vibratoPos & 0x3F] * 8 + autoVibFinal;
 
-					if (Inst.volType & 0x02)
-					{
-						if (Ch.volEnvelope != Inst.volEnvelops[Inst.volSustainPt * 2] || Ch.fading)
-							Ch.volEnvelope ++;
-					}
-					else Ch.volEnvelope ++;
+					//Whole linear periods (no vibrato) are looked up
+					int32_t tabIndex = (int32_t)realPeriod - PERIOD_TAB_MIN;
+					uint32_t tabDelta = 0;
+					if (!useAmigaFreqTable && tabIndex >= 0 && tabIndex < PERIOD_TAB_SIZE && tabIndex + PERIOD_TAB_MIN == realPeriod)
+						tabDelta = linearDeltaTab[tabIndex];
 
-					if (Inst.volType & 0x04)
+					if (tabDelta != 0) Ch.delta = tabDelta;
+					else
 					{
-						if (Ch.volEnvelope >= Inst.volEnvelops[Inst.volLoopEnd * 2])
-							Ch.volEnvelope = Inst.volEnvelops[Inst.volLoopStart * 2];
-					}
-
-					if (Ch.volEnvelope >= volEnv.maxPoint)
-						Ch.volEnvelope = volEnv.maxPoint;
+						double freq;
+						if (!useAmigaFreqTable)
+							freq = 8363 * pow(2, (4608 - realPeriod) / 768);
+						else freq = 8363.0 * 1712 / realPeriod;
 
-					int16_t instFadeout = Inst.fadeOut;
-					int32_t fadeOutVol;
-					if (Ch.fading && instFadeout > 0)
-					{
-						int16_t FadeOutLeng = 32768 / instFadeout;
-						if (Ch.fadeTick < FadeOutLeng) Ch.fadeTick ++;
-						else Ch.active = false;
-						fadeOutVol = 64 * (FadeOutLeng - Ch.fadeTick) / FadeOutLeng;
+						Ch.delta = (uint32_t)(freq / sampleRate * TOINT_SCL);
 					}
-					else fadeOutVol = 64;
-
-					Ch.volTargetInst = volEnv.value;
-					//Ch.volTarget = fadeOutVol*globalVol/64*realVol/64;
-					//Ch.volTarget = fadeOutVol*volEnv.value/64*globalVol/64*realVol/64;
-					volTarget = fadeOutVol * globalVol / 64 * realVol / 64;
 				}
-				else
-				{
-					Ch.volTargetInst = 64;
-					if (Ch.fading) Ch.volume = 0;
-				}
-				Ch.volTargetInst <<= INT_ACC_RAMPING;
+				else updateStats.periodSkipped ++;
 
-				volTarget = MAX(MIN(volTarget, 64), 0);
+				const HotInstrument &Inst = hotInstruments[Ch.instrument - 1];
 
-				//Panning
-				Ch.pan = MAX(MIN(Ch.pan, 255), 0);
-				if (Inst.panType & 0x01)
+				//Envelopes move on every tick, a new value or a fade works out the volume and pan again
+				if (Inst.volType & 0x01)
 				{
-					EnvInfo panEnv = CalcEnvelope(Inst, Ch.panEnvelope, true);
-					if (Inst.panType & 0x02)
-					{
-						if (Ch.panEnvelope != Inst.panEnvelops[Inst.panSustainPt * 2] || Ch.fading)
-							Ch.panEnvelope ++;
-					}
-					else Ch.panEnvelope ++;
+					uint8_t volEnvValue = EnvelopeValue(Inst.volEnv, instruments[Ch.instrument - 1], Ch.volEnvelope, false);
+					AdvanceEnvelope(Inst.volEnv, Inst.volType, Ch.fading, Ch.volEnvelope);
 
-					if (Inst.panType & 0x04)
-					{
-						if (Ch.panEnvelope >= Inst.panEnvelops[Inst.panLoopEnd * 2])
-							Ch.panEnvelope = Inst.panEnvelops[Inst.panLoopStart * 2];
-					}
+					if (volEnvValue != Ch.volEnvValue || (Ch.fading && Inst.fadeOut > 0)) Ch.dirty |= CH_DIRTY_VOLUME;
+					Ch.volEnvValue = volEnvValue;
+				}
 
-					if (Ch.panEnvelope >= panEnv.maxPoint)
-						Ch.panEnvelope = panEnv.maxPoint;
+				if (Inst.panType & 0x01)
+				{
+					uint8_t panEnvValue = EnvelopeValue(Inst.panEnv, instruments[Ch.instrument - 1], Ch.panEnvelope, true);
+					AdvanceEnvelope(Inst.panEnv, Inst.panType, Ch.fading, Ch.panEnvelope);
 
-					Ch.panFinal = Ch.pan + (((panEnv.value - 32) * (128 - abs(Ch.pan - 128))) >> 5);
+					if (panEnvValue != Ch.panEnvValue) Ch.dirty |= CH_DIRTY_VOLUME;
+					Ch.panEnvValue = panEnvValue;
 				}
-				else Ch.panFinal = Ch.pan;
-				Ch.panFinal = MAX(MIN(Ch.panFinal, 255), 0);
+
+				//Ramps still running get new speeds every tick
+				if (Ch.volFinalL != Ch.volTargetL || Ch.volFinalR != Ch.volTargetR || Ch.volFinalInst != Ch.volTargetInst)
+					Ch.dirty |= CH_DIRTY_VOLUME;
 
 				//sample info
-				Sample curSample = samples[Ch.samplePlaying];
-				Ch.data = curSample.data;
-				Ch.loopType = curSample.type;
+				if (Ch.dirty & CH_DIRTY_SAMPLE)
+				{
+					const Sample &curSample = samples[Ch.samplePlaying];
+					if (!samplesCompressed) Ch.data = curSample.data;
+					Ch.loopType = curSample.type;
 
-				Ch.is16Bit = curSample.is16Bit;
-				Ch.smpLeng = curSample.length;
-				Ch.loopStart = curSample.loopStart;
-				Ch.loopLeng = curSample.loopLength;
-				Ch.loopEnd = Ch.loopStart + Ch.loopLeng;
+					Ch.is16Bit = curSample.is16Bit || sampleFormat == SAMPLE_INT16 || samplesCompressed;
+					Ch.smpLeng = curSample.length;
+					Ch.loopStart = curSample.loopStart;
+					Ch.loopLeng = curSample.loopLength;
+					Ch.loopEnd = Ch.loopStart + Ch.loopLeng;
 
-				if (Ch.loopType >= 2)
-				{
-					Ch.loopEnd += Ch.loopLeng;
-					Ch.loopLeng <<= 1;
+					if (Ch.loopType >= 2)
+					{
+						Ch.reversePos = Ch.loopEnd;
+						Ch.mirrorPos = (Ch.loopEnd << 1) - 2;
+						Ch.loopEnd += Ch.loopLeng;
+						Ch.loopLeng <<= 1;
+					}
+					if (!Ch.loopType) Ch.loop = 0;
 				}
-				if (!Ch.loopType) Ch.loop = 0;
+				else updateStats.sampleSkipped ++;
 
-				//Set volume ramping
-				double volRampSmps = samplePerTick;
-				double instVolRampSmps = samplePerTick;
-				if (Ch.LxxEffect)
+				//The volume block changes its own inputs (key-off without a volume envelope clears the volume
+				//and the fade), a channel it does that to is worked out again on the next tick
+				uint8_t nextDirty = 0;
+				if (Ch.dirty & CH_DIRTY_VOLUME)
 				{
-					instVolRampSmps = VOLRAMP_NEW_INSTR;
-					Ch.LxxEffect = false;
-				}
+					//volume
+					Ch.volume = MAX(MIN(Ch.volume, 64), 0);
+					int16_t realVol = Ch.tremorMute ? 0 : (int8_t)MAX(MIN(Ch.volume + Ch.tremorAmp * sineTab[Ch.tremorPos & 0x3F] * 4, 64), 0);
+					int16_t volTarget = realVol * globalVol / 64;
+					if (Inst.volType & 0x01)
+					{
+						int16_t instFadeout = Inst.fadeOut;
+						int32_t fadeOutVol;
+						if (Ch.fading && instFadeout > 0)
+						{
+							int16_t FadeOutLeng = 32768 / instFadeout;
+							if (Ch.fadeTick < FadeOutLeng) Ch.fadeTick ++;
+							else Ch.active = false;
+							fadeOutVol = 64 * (FadeOutLeng - Ch.fadeTick) / FadeOutLeng;
+						}
+						else fadeOutVol = 64;
+
+						Ch.volTargetInst = Ch.volEnvValue;
+						//Ch.volTarget = fadeOutVol*globalVol/64*realVol/64;
+						//Ch.volTarget = fadeOutVol*volEnv.value/64*globalVol/64*realVol/64;
+						volTarget = fadeOutVol * globalVol / 64 * realVol / 64;
+					}
+					else
+					{
+						Ch.volTargetInst = 64;
+						if (Ch.fading)
+						{
+							Ch.volume = 0;
+							nextDirty |= CH_DIRTY_VOLUME;
+						}
+					}
+					Ch.volTargetInst <<= INT_ACC_RAMPING;
 
-				if (((Ch.volCmd & 0xF0) >= 0x10 &&
-					(Ch.volCmd & 0xF0) <= 0x50) ||
-					(Ch.volCmd & 0xF0) == 0xC0 ||
-					Ch.effect == 12 || Ch.effect == 8 ||
-					(Ch.effect == 0x14 && (Ch.parameter & 0xF0) == 0xC0))
-					volRampSmps = VOLRAMP_VOLSET_SAMPLES;
+					volTarget = MAX(MIN(volTarget, 64), 0);
 
-				if (!(Inst.volType & 0x01) && Ch.fading)
-				{
-					volTarget = 0;
-					Ch.fading = false;
-					volRampSmps = VOLRAMP_VOLSET_SAMPLES;
-				}
+					//Panning
+					Ch.pan = MAX(MIN(Ch.pan, 255), 0);
+					if (Inst.panType & 0x01)
+						Ch.panFinal = Ch.pan + (((Ch.panEnvValue - 32) * (128 - abs(Ch.pan - 128))) >> 5);
+					else Ch.panFinal = Ch.pan;
+					Ch.panFinal = MAX(MIN(Ch.panFinal, 255), 0);
 
-				if (Ch.instTrig)
-				{
-					//Ch.VolFinal = Ch.volTarget;
-					//Ch.volFinalInst = Ch.volTargetInst;
+					//Set volume ramping
+					double volRampSmps = samplePerTick;
+					double instVolRampSmps = samplePerTick;
+					if (Ch.LxxEffect)
+					{
+						instVolRampSmps = VOLRAMP_NEW_INSTR;
+						Ch.LxxEffect = false;
+					}
 
-					volRampSmps = VOLRAMP_VOLSET_SAMPLES;
-					instVolRampSmps = VOLRAMP_NEW_INSTR;
+					if (((Ch.volCmd & 0xF0) >= 0x10 &&
+						(Ch.volCmd & 0xF0) <= 0x50) ||
+						(Ch.volCmd & 0xF0) == 0xC0 ||
+						Ch.effect == 12 || Ch.effect == 8 ||
+						(Ch.effect == 0x14 && (Ch.parameter & 0xF0) == 0xC0))
+						volRampSmps = VOLRAMP_VOLSET_SAMPLES;
 
-					//Ch.volFinalL = Ch.volFinalR = 0;
-					Ch.instTrig = false;
-				}
-				//else if (Ch.effect == 0xA)
-				//    volRampSmps = samplePerTick;
+					if (!(Inst.volType & 0x01) && Ch.fading)
+					{
+						volTarget = 0;
+						Ch.fading = false;
+						volRampSmps = VOLRAMP_VOLSET_SAMPLES;
+						nextDirty |= CH_DIRTY_VOLUME;
+					}
 
-				if (stereo)
-				{
-					if (!panMode)
+					if (Ch.instTrig)
 					{
-						//https://modarchive.org/forums/index.php?topic=3517.0
-						//FT2 square root panning law
-						Ch.volTargetL = (int32_t)(volTarget * sqrt((256 - Ch.panFinal) / 256.0) / .707) << INT_ACC_RAMPING;
-						Ch.volTargetR = (int32_t)(volTarget * sqrt(Ch.panFinal / 256.0) / .707) << INT_ACC_RAMPING;
+						//Ch.VolFinal = Ch.volTarget;
+						//Ch.volFinalInst = Ch.volTargetInst;
+
+						volRampSmps = VOLRAMP_VOLSET_SAMPLES;
+						instVolRampSmps = VOLRAMP_NEW_INSTR;
+
+						//Ch.volFinalL = Ch.volFinalR = 0;
+						Ch.instTrig = false;
 					}
-					else
+					//else if (Ch.effect == 0xA)
+					//    volRampSmps = samplePerTick;
+
+					if (stereo)
 					{
-						//Linear panning
-						if (Ch.panFinal > 128)
+						if (!panMode)
 						{
-							Ch.volTargetL = volTarget * (256 - Ch.panFinal) / 128.0;
-							Ch.volTargetR = volTarget;
+							//https://modarchive.org/forums/index.php?topic=3517.0
+							//FT2 square root panning law
+							Ch.volTargetL = (int32_t)(volTarget * panLawTab[256 - Ch.panFinal] / .707) << INT_ACC_RAMPING;
+							Ch.volTargetR = (int32_t)(volTarget * panLawTab[Ch.panFinal] / .707) << INT_ACC_RAMPING;
 						}
 						else
 						{
-							Ch.volTargetL = volTarget;
-							Ch.volTargetR = volTarget * (Ch.panFinal / 128.0);
+							//Linear panning
+							if (Ch.panFinal > 128)
+							{
+								Ch.volTargetL = volTarget * (256 - Ch.panFinal) / 128.0;
+								Ch.volTargetR = volTarget;
+							}
+							else
+							{
+								Ch.volTargetL = volTarget;
+								Ch.volTargetR = volTarget * (Ch.panFinal / 128.0);
+							}
+							Ch.volTargetL <<= INT_ACC_RAMPING;
+							Ch.volTargetR <<= INT_ACC_RAMPING;
 						}
-						Ch.volTargetL <<= INT_ACC_RAMPING;
-						Ch.volTargetR <<= INT_ACC_RAMPING;
 					}
-				}
-				else Ch.volTargetL = Ch.volTargetR = (volTarget << INT_ACC_RAMPING);
+					else Ch.volTargetL = Ch.volTargetR = (volTarget << INT_ACC_RAMPING);
 
-				Ch.volRampSpdL = (Ch.volTargetL - Ch.volFinalL) / volRampSmps;
-				Ch.volRampSpdR = (Ch.volTargetR - Ch.volFinalR) / volRampSmps;
-				Ch.volRampSpdInst = (Ch.volTargetInst - Ch.volFinalInst) / instVolRampSmps;
+					Ch.volRampSpdL = (Ch.volTargetL - Ch.volFinalL) / volRampSmps;
+					Ch.volRampSpdR = (Ch.volTargetR - Ch.volFinalR) / volRampSmps;
+					Ch.volRampSpdInst = (Ch.volTargetInst - Ch.volFinalInst) / instVolRampSmps;
 
-				if (Ch.volRampSpdL == 0) Ch.volFinalL = Ch.volTargetL;
-				if (Ch.volRampSpdR == 0) Ch.volFinalR = Ch.volTargetR;
-				if (Ch.volRampSpdInst == 0) Ch.volFinalInst = Ch.volTargetInst;
+					if (Ch.volRampSpdL == 0) Ch.volFinalL = Ch.volTargetL;
+					if (Ch.volRampSpdR == 0) Ch.volFinalR = Ch.volTargetR;
+					if (Ch.volRampSpdInst == 0) Ch.volFinalInst = Ch.volTargetInst;
+				}
+				else updateStats.volumeSkipped ++;
+
+				Ch.dirty = nextDirty;
+				updateStats.channelTicks ++;
 			}
 			else Ch.volFinalL = Ch.volFinalR = 0;
 			i ++;
@@ -1414,7 +4553,7 @@ namespace GXMPlayer
 				else Ch.delay = para;
 				break;
 			case 21:    //Lxx
-				if (Ch.instrument && Ch.instrument <= numOfInstruments)
+				if (Ch.instrument)
 				{
 					if (instruments[Ch.instrument - 1].volType & 0x02)
 						Ch.panEnvelope = para;
@@ -1507,6 +4646,28 @@ namespace GXMPlayer
 		}
 	}
 
+	static void EndArpeggio(uint8_t i)
+	{
+		if ((Ch.noteArpeggio <= 119 && Ch.noteArpeggio > 0) || Ch.periodOfs != 0/*&& (Ch.effect != 0 || Ch.parameter == 0)*/)
+		{
+			Ch.periodOfs = 0;
+			Ch.noteArpeggio = 0;
+			if (useAmigaFreqTable)
+				Ch.period = Ch.targetPeriod;
+			Ch.dirty |= CH_DIRTY_PERIOD;
+		}
+	}
+
+	//A cell without vibrato starts it over, unless the volume column vibrato is on
+	static inline void EndVibrato(uint8_t i)
+	{
+		if (!Ch.volVibrato && Ch.vibratoPos != 0)
+		{
+			Ch.vibratoPos = 0;
+			Ch.dirty |= CH_DIRTY_PERIOD;
+		}
+	}
+
 	static void ChkNote(Note thisNote, uint8_t i, bool byPassDelayChk, bool RxxRetrig = false)
 	{
 		/*
@@ -1522,6 +4683,9 @@ namespace GXMPlayer
 		//if (thisNote.note > 96 || thisNote.note == 0) note = Ch.note;
 		//Ch.note = note;
 
+		//A cell can change anything, ChkEffectRow() included
+		Ch.dirty = CH_DIRTY_ALL;
+
 		Note thisNoteOrig = thisNote;
 		if (byPassDelayChk)
 		{
@@ -1532,13 +4696,7 @@ namespace GXMPlayer
 			thisNote.parameter = Ch.parameter;
 		}
 
-		if ((Ch.noteArpeggio <= 119 && Ch.noteArpeggio > 0) || Ch.periodOfs != 0/*&& (Ch.effect != 0 || Ch.parameter == 0)*/)
-		{
-			Ch.periodOfs = 0;
-			Ch.noteArpeggio = 0;
-			if (useAmigaFreqTable)
-				Ch.period = Ch.targetPeriod;
-		}
+		EndArpeggio(i);
 
 		bool porta = (thisNote.effect == 3 || thisNote.effect == 5 || ((thisNote.volCmd & 0xF0) == 0xF0));
 
@@ -1565,7 +4723,8 @@ namespace GXMPlayer
 			int16_t oldSamp = Ch.sample;
 
 			bool invalidInstr = true;
-			if (instNum && instNum <= numOfInstruments && noteNum < 97)
+			//Instruments a streamed module hasn't got to yet are invalid until they arrive
+			if (instNum && instNum <= hotInstReady.load(std::memory_order_acquire) && noteNum < 97)
 			{
 				if (instruments[instNum - 1].sampleNum > 0)
 				{
@@ -1605,13 +4764,16 @@ namespace GXMPlayer
 				}
 				else Ch.instrument = Ch.nextInstrument;
 
-				if (Ch.nextInstrument && Ch.nextInstrument <= numOfInstruments)
+				if (Ch.nextInstrument && Ch.nextInstrument != 255)
 				{
 					Ch.sample = instruments[Ch.nextInstrument - 1].sampleMap[noteNum - 1];
 
+					//Samples still streaming in play as no sample
+					if (Ch.sample != -1 && SampleArriving(Ch.sample)) Ch.sample = -1;
+
 					if (Ch.sample != -1 && !porta)
 					{
-						Sample smp = samples[Ch.sample];
+						const Sample &smp = samples[Ch.sample];
 						int8_t relNote = smp.relNote;
 						int8_t finalNote = noteNum + relNote;
 
@@ -1637,6 +4799,8 @@ namespace GXMPlayer
 						{
 							Ch.period = Ch.targetPeriod;
 							Ch.samplePlaying = Ch.sample;
+							if (voiceBlocks != NULL) voiceBlocks[i].sample = -1;
+							EnsureSampleDecoded(Ch.samplePlaying);
 							Ch.autoVibPos = Ch.autoVibSweep = 0;
 							Ch.loop = 0;
 
@@ -1645,10 +4809,12 @@ namespace GXMPlayer
 							if (thisNote.effect == 9) Ch.pos = thisNote.parameter << 8;
 							else Ch.pos = 0;
 
-							if (Ch.pos > samples[Ch.samplePlaying].length) Ch.pos = samples[Ch.samplePlaying].length;
+							//Notes mapped to no sample stop the channel
+							if (Ch.samplePlaying == -1) Ch.active = false;
+							else if (Ch.pos > samples[Ch.samplePlaying].length) Ch.pos = samples[Ch.samplePlaying].length;
 
 							//NoteTrig = true;
-							if (!Ch.active && !instNum)
+							if (!Ch.active && !instNum && Ch.samplePlaying != -1)
 							{
 								trigByNote = true;
 								goto TrigInst;
@@ -1671,8 +4837,12 @@ namespace GXMPlayer
 				if (!RxxRetrig && thisNoteOrig.instrument)
 				{
 					//Ch.volFinalL = Ch.volFinalR = 0;
-					Ch.volume = trigByNote ? Ch.lastVol : Ch.lastVol = samples[Ch.samplePlaying].volume;
-					Ch.pan = samples[Ch.samplePlaying].pan;
+					//Nothing has played on the channel yet if an instrument comes before any note
+					if (Ch.samplePlaying != -1)
+					{
+						Ch.volume = trigByNote ? Ch.lastVol : Ch.lastVol = samples[Ch.samplePlaying].volume;
+						Ch.pan = samples[Ch.samplePlaying].pan;
+					}
 					Ch.tremorMute = false;
 					Ch.tremorTick = 0;
 					//Ch.autoVibPos = Ch.autoVibSweep = 0;
@@ -1711,7 +4881,7 @@ namespace GXMPlayer
 		uint8_t subEffect = para & 0xF0;
 		uint8_t subPara = para & 0x0F;
 
-		if (effect != 4 && effect != 6 && !Ch.volVibrato) Ch.vibratoPos = 0;
+		if (effect != 4 && effect != 6) EndVibrato(i);
 		if (effect != 27) Ch.RxxCounter = 0;
 
 		uint8_t onTime, offTime;
@@ -1721,12 +4891,15 @@ namespace GXMPlayer
 		{
 		case 1: //1xx
 			Ch.period -= Ch.slideUpSpd * 4;
+			Ch.dirty |= CH_DIRTY_PERIOD;
 			break;
 		case 2: //2xx
 			Ch.period += Ch.slideDnSpd * 4;
+			Ch.dirty |= CH_DIRTY_PERIOD;
 			break;
 		case 3: //3xx
 		PortaEffect:
+			Ch.dirty |= CH_DIRTY_PERIOD;
 			if (Ch.period > Ch.targetPeriod)
 				Ch.period -= Ch.slideSpd * 4;
 			else if (Ch.period < Ch.targetPeriod)
@@ -1736,29 +4909,36 @@ namespace GXMPlayer
 			break;
 		case 4: //4xx
 		VibratoEffect:
+			Ch.dirty |= CH_DIRTY_PERIOD;
 			Ch.vibratoAmp = Ch.vibratoPara & 0xF;
 			Ch.vibratoPos += (Ch.vibratoPara >> 4) & 0x0F;
 			break;
 		case 5: //5xx
 			Ch.volume += Ch.volSlideSpd;
+			Ch.dirty |= CH_DIRTY_VOLUME;
 			goto PortaEffect;
 			break;
 		case 6: //6xx
 			Ch.volume += Ch.volSlideSpd;
+			Ch.dirty |= CH_DIRTY_VOLUME;
 			goto VibratoEffect;
 			break;
 		case 7: //7xx
 			Ch.tremorAmp = Ch.tremoloPara & 0xF;
 			Ch.tremorPos += (Ch.tremoloPara >> 4) & 0x0F;
+			Ch.dirty |= CH_DIRTY_VOLUME;
 			break;
 		case 8: //8xx
 			Ch.pan = para;
+			Ch.dirty |= CH_DIRTY_VOLUME;
 			break;
 		case 10:    //Axx
 			Ch.volume += Ch.volSlideSpd;
+			Ch.dirty |= CH_DIRTY_VOLUME;
 			break;
 		case 12:    //Cxx
 			Ch.volume = para;
+			Ch.dirty |= CH_DIRTY_VOLUME;
 			break;
 		case 14:    //Exx
 			switch (subEffect)
@@ -1772,7 +4952,10 @@ namespace GXMPlayer
 				break;
 			case 0xC0:  //ECx
 				if (Ch.delay <= 0)
+				{
 					Ch.volume = 0;
+					Ch.dirty |= CH_DIRTY_VOLUME;
+				}
 				break;
 			case 0xD0:  //EDx
 				if (Ch.delay <= 1 && Ch.delay != -1 && !Ch.keyOff) ChkNote(thisNote, i, true);
@@ -1786,10 +4969,12 @@ namespace GXMPlayer
 			if (Ch.delay <= 0)
 			{
 				Ch.keyOff = Ch.fading = true;
+				Ch.dirty |= CH_DIRTY_VOLUME;
 			}
 			break;
 		case 25:    //Pxx
 			Ch.pan += Ch.panSlideSpd;
+			Ch.dirty |= CH_DIRTY_VOLUME;
 			break;
 		case 27:    //Rxx
 			Ch.RxxCounter ++;
@@ -1829,6 +5014,7 @@ namespace GXMPlayer
 			offTime = (Ch.tremorPara & 0xF) + 1;
 			Ch.tremorMute = (Ch.tremorTick > onTime);
 			if (Ch.tremorTick >= onTime + offTime) Ch.tremorTick = 0;
+			Ch.dirty |= CH_DIRTY_VOLUME;
 			break;
 		}
 
@@ -1839,22 +5025,28 @@ namespace GXMPlayer
 		{
 		case 0x60:  //Dx
 			Ch.volume -= volPara;
+			Ch.dirty |= CH_DIRTY_VOLUME;
 			break;
 		case 0x70:  //Ux
 			Ch.volume += volPara;
+			Ch.dirty |= CH_DIRTY_VOLUME;
 			break;
 		case 0xB0:  //Vx
 			Ch.vibratoAmp = Ch.vibratoPara & 0xF;
 			Ch.vibratoPos += (Ch.vibratoPara >> 4) & 0x0F;
 			Ch.volVibrato = true;
+			Ch.dirty |= CH_DIRTY_PERIOD;
 			break;
 		case 0xD0:  //Lx
 			Ch.pan -= volPara;
+			Ch.dirty |= CH_DIRTY_VOLUME;
 			break;
 		case 0xE0:  //Rx
 			Ch.pan += volPara;
+			Ch.dirty |= CH_DIRTY_VOLUME;
 			break;
 		case 0xF0:  //Mx
+			Ch.dirty |= CH_DIRTY_PERIOD;
 			if (Ch.period > Ch.targetPeriod)
 				Ch.period -= Ch.slideSpd * 4;
 			else if (Ch.period < Ch.targetPeriod)
@@ -1865,6 +5057,33 @@ namespace GXMPlayer
 		}
 	}
 
+	//Non-empty cells of a row, a row past the end of the pattern (pattern loop bug emulation) has none
+	static inline const CellEvent *RowCells(uint8_t pattern, int16_t row, const CellEvent *&cellEnd)
+	{
+		int16_t patternLeng = *(int16_t *)(patternData + patternAddr[pattern]);
+		const int32_t *rowFirst = rowEvents + patternRowBase[pattern] + MIN(row, patternLeng);
+
+		cellEnd = cellEvents + rowFirst[1];
+		return cellEvents + rowFirst[0];
+	}
+
+	//What NextRow() and ChkNote() do for an empty cell
+	static inline void EmptyCellRow(uint8_t i)
+	{
+		Ch.volCmd = Ch.volPara = Ch.effect = Ch.parameter = 0;
+		EndArpeggio(i);
+		EndVibrato(i);
+		Ch.delay = -1;
+	}
+
+	//What ChkEffectTick() does for a cell without tick effects
+	static inline void EmptyCellTick(uint8_t i)
+	{
+		EndVibrato(i);
+		Ch.RxxCounter = 0;
+		if (Ch.delay > -1) Ch.delay --;
+	}
+
 	static void NextRow()
 	{
 		if (patDelay <= 0)
@@ -1914,10 +5133,20 @@ namespace GXMPlayer
 				}
 			}
 
+			const CellEvent *cellEnd;
+			const CellEvent *cell = RowCells(orderTable[curPos], curRow, cellEnd);
+
 			int i = 0;
 			while (i < numOfChannels)
 			{
-				Note ThisNote = GetNote(orderTable[curPos], curRow, i);
+				if (cell == cellEnd || cell->channel != i)
+				{
+					EmptyCellRow(i);
+					i ++;
+					continue;
+				}
+
+				Note ThisNote = (cell++)->note;
 
 				if (ThisNote.note != 0) Ch.lastNote = ThisNote.note;
 				if (ThisNote.instrument != 0) Ch.lastInstrument = ThisNote.instrument;
@@ -1948,11 +5177,18 @@ namespace GXMPlayer
 
 		if (curRow >= 0)
 		{
+			const CellEvent *cellEnd;
+			const CellEvent *cell = RowCells(orderTable[curPos], curRow, cellEnd);
+
 			while (i < numOfChannels)
 			{
-				Note ThisNote = GetNote(orderTable[curPos], curRow, i);
-
-				ChkEffectTick(i, ThisNote);
+				if (cell != cellEnd && cell->channel == i)
+				{
+					if (cell->tickEffect) ChkEffectTick(i, cell->note);
+					else EmptyCellTick(i);
+					cell ++;
+				}
+				else EmptyCellTick(i);
 
 				i ++;
 			}
@@ -1971,7 +5207,7 @@ namespace GXMPlayer
 		{
 			if (Ch.active)
 			{
-				if (Ch.samplePlaying != -1 && Ch.samplePlaying < totalSampleNum)
+				if (Ch.samplePlaying != -1)
 				{
 					int32_t chPos = Ch.pos;
 
@@ -2124,7 +5360,7 @@ namespace GXMPlayer
 \
 		if (Ch.active)\
 		{\
-			if (Ch.samplePlaying != -1 && Ch.samplePlaying < totalSampleNum)\
+			if (Ch.samplePlaying != -1)\
 			{\
 				int32_t chPos = Ch.pos;\
 \
@@ -2160,13 +5396,27 @@ namespace GXMPlayer
 	if (chPos >= Ch.smpLeng)\
 	{\
 		Ch.active = false;\
-		Ch.endSmp = Ch.is16Bit ? *(int16_t *)(Ch.data + ((Ch.smpLeng - 1) << 1)) : (int16_t)(Ch.data[Ch.smpLeng - 1] << 8);\
+		if (sampleFormat == SAMPLE_FLOAT) Ch.endSmp = ((float *)Ch.data)[Ch.smpLeng - 1];\
+		else Ch.endSmp = Ch.is16Bit ? *(int16_t *)(Ch.data + ((Ch.smpLeng - 1) << 1)) : (int16_t)(Ch.data[Ch.smpLeng - 1] << 8);\
 		Ch.samplePlaying = -1;\
 		Ch.endCount = 0;\
 	}\
 	Ch.pos = chPos;
 
+//Compressed samples, the last frame is decoded first so MIXNOLOOP can keep it for the end ramp
+#define MIXNOLOOPBLOCK\
+	if (chPos >= Ch.smpLeng)\
+		LoadSampleBlock(Ch, voiceBlocks[i], Ch.smpLeng - 1);\
+	MIXNOLOOP
+
+//Positions run up to loopEnd itself, the guard frame there holds the loop start so the frame
+//before any position is always the previous stored frame
 #define MIXLOOP\
+	if (chPos > Ch.loopEnd)\
+		chPos = Ch.loopStart + 1 + (chPos - Ch.loopStart - 1) % Ch.loopLeng;\
+	Ch.pos = chPos;
+
+#define MIXLOOPBIDI\
 	if (chPos < Ch.loopStart)\
 		Ch.loop = 0;\
 	else if (chPos >= Ch.loopEnd)\
@@ -2182,27 +5432,34 @@ namespace GXMPlayer
 	if (Ch.startCount >= SMP_CHANGE_RAMP)\
 	{
 
+//Compressed samples, decodes the next block once the position leaves the current one
+#define MIXPART1BLOCK(A)\
+	MIXPART1(A)\
+		if (voiceBlocks[i].sample != Ch.samplePlaying || (uint32_t)(chPos - voiceBlocks[i].first) >= BLOCK_FRAMES)\
+			LoadSampleBlock(Ch, voiceBlocks[i], chPos);
+
 #define MIXINTERPOLINIT\
+	int32_t prevPos = chPos - 1;\
+	uint16_t ix = Ch.posL16 >> 1;
+
+#define MIXINTERPOLINITBIDI\
 	int32_t prevPos = chPos;\
 \
 	if (chPos > 0) prevPos -- ;\
 \
 	if (Ch.loop == 1 && chPos <= Ch.loopStart)\
 		prevPos = Ch.loopEnd - 1;\
-\
-	int16_t prevData;\
-	int32_t dy;\
 \
 	uint16_t ix = Ch.posL16 >> 1;
 
 #define MIXINTERPOL16BIT\
-	prevData = *(int16_t *)(Ch.data + (prevPos << 1));\
-	dy = *(int16_t *)(Ch.data + (chPos << 1)) - prevData;\
+	int16_t prevData = *(int16_t *)(Ch.data + (prevPos << 1));\
+	int32_t dy = *(int16_t *)(Ch.data + (chPos << 1)) - prevData;\
 	result = (prevData + ((dy * ix) >> INT_ACC_INTERPOL));
 
 #define MIXINTERPOL8BIT\
-	prevData = Ch.data[prevPos] << 8;\
-	dy = (Ch.data[chPos] << 8) - prevData;\
+	int16_t prevData = Ch.data[prevPos] << 8;\
+	int32_t dy = (Ch.data[chPos] << 8) - prevData;\
 	result = (prevData + ((dy * ix) >> INT_ACC_INTERPOL));
 
 #define MIXNEAREST16BIT\
@@ -2211,6 +5468,51 @@ namespace GXMPlayer
 #define MIXNEAREST8BIT\
 	result = (int16_t)(Ch.data[chPos] << 8);
 
+//Bidi loops that are not unrolled, the position still runs over the unrolled length and is folded
+//back at reversePos, so mirrorPos - pos reads what MirrorLoop() would have copied there (-1 reads 0)
+//The guard frames don't follow the fold, so these wrap in [loopStart, loopEnd) and find the previous frame themselves
+#define MIXBIDIPOS(P) ((P) < Ch.reversePos ? (P) : Ch.mirrorPos - (P))
+
+#define MIXINTERPOLBIDI16BIT\
+	int32_t readPrev = MIXBIDIPOS(prevPos);\
+	int32_t readPos = MIXBIDIPOS(chPos);\
+	int16_t prevData = readPrev >= 0 ? *(int16_t *)(Ch.data + (readPrev << 1)) : 0;\
+	int32_t dy = (readPos >= 0 ? *(int16_t *)(Ch.data + (readPos << 1)) : 0) - prevData;\
+	result = (prevData + ((dy * ix) >> INT_ACC_INTERPOL));
+
+#define MIXINTERPOLBIDI8BIT\
+	int32_t readPrev = MIXBIDIPOS(prevPos);\
+	int32_t readPos = MIXBIDIPOS(chPos);\
+	int16_t prevData = readPrev >= 0 ? Ch.data[readPrev] << 8 : 0;\
+	int32_t dy = (readPos >= 0 ? Ch.data[readPos] << 8 : 0) - prevData;\
+	result = (prevData + ((dy * ix) >> INT_ACC_INTERPOL));
+
+#define MIXNEARESTBIDI16BIT\
+	int32_t readPos = MIXBIDIPOS(chPos);\
+	result = readPos >= 0 ? *(int16_t *)(Ch.data + (readPos << 1)) : 0;
+
+#define MIXNEARESTBIDI8BIT\
+	int32_t readPos = MIXBIDIPOS(chPos);\
+	result = readPos >= 0 ? (int16_t)(Ch.data[readPos] << 8) : 0;
+
+//SAMPLE_FLOAT, frames hold the same values the 16-bit kernels read
+#define MIXINTERPOLFLOAT\
+	float prevFloat = ((float *)Ch.data)[prevPos];\
+	result = prevFloat + (((float *)Ch.data)[chPos] - prevFloat) * (ix * (1.0f / 32768));
+
+#define MIXNEARESTFLOAT\
+	result = ((float *)Ch.data)[chPos];
+
+#define MIXINTERPOLBIDIFLOAT\
+	int32_t readPrev = MIXBIDIPOS(prevPos);\
+	int32_t readPos = MIXBIDIPOS(chPos);\
+	float prevFloat = readPrev >= 0 ? ((float *)Ch.data)[readPrev] : 0;\
+	result = prevFloat + ((readPos >= 0 ? ((float *)Ch.data)[readPos] : 0) - prevFloat) * (ix * (1.0f / 32768));
+
+#define MIXNEARESTBIDIFLOAT\
+	int32_t readPos = MIXBIDIPOS(chPos);\
+	result = readPos >= 0 ? ((float *)Ch.data)[readPos] : 0;
+
 #define MIXSUFFIX(A,B)\
 					if (Ch.startCount < SMP_CHANGE_RAMP + SMP_CHANGE_RAMP)\
 					{\
@@ -2269,7 +5571,161 @@ namespace GXMPlayer
 		{
 			int32_t posFinal = pos << 1;
 
-			if (!Ch.loopType)
+			//Compressed samples are read from decoded 16-bit blocks with bidi loops unrolled,
+			//only these kernels check the block so the others stay as they are
+			if (samplesCompressed)
+			{
+				if (!Ch.loopType)
+				{
+					if (interpolation)
+					{
+						MIXPREFIX
+
+							MIXNOLOOPBLOCK
+
+							MIXPART1BLOCK(C19)
+
+							MIXINTERPOLINIT
+
+							MIXINTERPOL16BIT
+
+							MIXSUFFIX(C19, N19)
+					}
+					else
+					{
+						MIXPREFIX
+
+							MIXNOLOOPBLOCK
+
+							MIXPART1BLOCK(C20)
+
+							MIXNEAREST16BIT
+
+							MIXSUFFIX(C20, N20)
+					}
+				}
+				else
+				{
+					if (interpolation)
+					{
+						MIXPREFIX
+
+							MIXLOOP
+
+							MIXPART1BLOCK(C21)
+
+							MIXINTERPOLINIT
+
+							MIXINTERPOL16BIT
+
+							MIXSUFFIX(C21, N21)
+					}
+					else
+					{
+						MIXPREFIX
+
+							MIXLOOP
+
+							MIXPART1BLOCK(C22)
+
+							MIXNEAREST16BIT
+
+							MIXSUFFIX(C22, N22)
+					}
+				}
+			}
+			//One kernel per loop type when every sample is float
+			else if (sampleFormat == SAMPLE_FLOAT)
+			{
+				if (!Ch.loopType)
+				{
+					if (interpolation)
+					{
+						MIXPREFIX
+
+							MIXNOLOOP
+
+							MIXPART1(C13)
+
+							MIXINTERPOLINIT
+
+							MIXINTERPOLFLOAT
+
+							MIXSUFFIX(C13, N13)
+					}
+					else
+					{
+						MIXPREFIX
+
+							MIXNOLOOP
+
+							MIXPART1(C14)
+
+							MIXNEARESTFLOAT
+
+							MIXSUFFIX(C14, N14)
+					}
+				}
+				else if (Ch.loopType >= 2 && !bidiUnrolled)
+				{
+					if (interpolation)
+					{
+						MIXPREFIX
+
+							MIXLOOPBIDI
+
+							MIXPART1(C15)
+
+							MIXINTERPOLINITBIDI
+
+							MIXINTERPOLBIDIFLOAT
+
+							MIXSUFFIX(C15, N15)
+					}
+					else
+					{
+						MIXPREFIX
+
+							MIXLOOPBIDI
+
+							MIXPART1(C16)
+
+							MIXNEARESTBIDIFLOAT
+
+							MIXSUFFIX(C16, N16)
+					}
+				}
+				else
+				{
+					if (interpolation)
+					{
+						MIXPREFIX
+
+							MIXLOOP
+
+							MIXPART1(C17)
+
+							MIXINTERPOLINIT
+
+							MIXINTERPOLFLOAT
+
+							MIXSUFFIX(C17, N17)
+					}
+					else
+					{
+						MIXPREFIX
+
+							MIXLOOP
+
+							MIXPART1(C18)
+
+							MIXNEARESTFLOAT
+
+							MIXSUFFIX(C18, N18)
+					}
+				}
+			}
+			else if (!Ch.loopType)
 			{
 				if (Ch.is16Bit)
 				{
@@ -2330,6 +5786,67 @@ namespace GXMPlayer
 					}
 				}
 			}
+			else if (Ch.loopType >= 2 && !bidiUnrolled)
+			{
+				if (Ch.is16Bit)
+				{
+					if (interpolation)
+					{
+						MIXPREFIX
+
+							MIXLOOPBIDI
+
+							MIXPART1(C9)
+
+							MIXINTERPOLINITBIDI
+
+							MIXINTERPOLBIDI16BIT
+
+							MIXSUFFIX(C9, N9)
+					}
+					else
+					{
+						MIXPREFIX
+
+							MIXLOOPBIDI
+
+							MIXPART1(C10)
+
+							MIXNEARESTBIDI16BIT
+
+							MIXSUFFIX(C10, N10)
+					}
+				}
+				else
+				{
+					if (interpolation)
+					{
+						MIXPREFIX
+
+							MIXLOOPBIDI
+
+							MIXPART1(C11)
+
+							MIXINTERPOLINITBIDI
+
+							MIXINTERPOLBIDI8BIT
+
+							MIXSUFFIX(C11, N11)
+					}
+					else
+					{
+						MIXPREFIX
+
+							MIXLOOPBIDI
+
+							MIXPART1(C12)
+
+							MIXNEARESTBIDI8BIT
+
+							MIXSUFFIX(C12, N12)
+					}
+				}
+			}
 			else
 			{
 				if (Ch.is16Bit)
@@ -2489,6 +6006,7 @@ namespace GXMPlayer
 	void SetPanMode(int8_t mode = 0)
 	{
 		panMode = mode;
+		channelsDirty = true;
 	}
 
 	void PlayPause(bool play)
@@ -2525,6 +6043,7 @@ namespace GXMPlayer
 	void SetStereo(bool UseStereo = false)
 	{
 		stereo = UseStereo;
+		channelsDirty = true;
 	}
 
 	void SetInterpolation(bool useInterpolation = true)
@@ -2550,6 +6069,69 @@ namespace GXMPlayer
 		ignoreF00 = trueFalse;
 	}
 
+	void SetLazyDecoding(int16_t orders)
+	{
+		lazyOrders = orders;
+	}
+
+	void SetUnrollBidiLoops(bool unroll)
+	{
+		unrollBidiLoops = unroll;
+	}
+
+	void SetSampleFormat(int8_t format)
+	{
+		widenFormat = MAX(MIN(format, (int8_t)SAMPLE_FLOAT), (int8_t)SAMPLE_NATIVE);
+	}
+
+	void SetCompressSamples(bool compress)
+	{
+		compressSamples = compress;
+	}
+
+	void SetCompactPatterns(bool compact)
+	{
+		compactPatterns = compact;
+	}
+
+	void SetPruneUnused(bool prune)
+	{
+		pruneUnused = prune;
+	}
+
+	int32_t GetPrunedSize()
+	{
+		return prunedSize;
+	}
+
+	bool GetMemoryStats(MemoryStats *stats)
+	{
+		if (!songLoaded) return false;
+
+		stats->patternDataSize = totalPatSize;
+		stats->sampleDataSize = totalSampleSize;
+		stats->instrumentSize = numOfInstruments * sizeof(Instrument);
+		stats->sampleSize = totalSampleNum * sizeof(Sample);
+		stats->channelSize = numOfChannels * sizeof(Channel) + (voiceBlocks != NULL ? numOfChannels * sizeof(VoiceBlock) : 0);
+		stats->eventSize = eventTableSize;
+		stats->hotInstrumentSize = hotInstSize;
+		stats->sourceSize = lazySourceSize;
+		stats->audioBufferSize = bufferSize * 2 * sizeof(int16_t);
+		stats->totalSize = (uint64_t)stats->patternDataSize + stats->sampleDataSize + stats->instrumentSize + stats->sampleSize
+			+ stats->channelSize + stats->eventSize + stats->hotInstrumentSize + stats->sourceSize + stats->audioBufferSize;
+		stats->loadPeakSize = loadPeak;
+
+		return true;
+	}
+
+	bool GetUpdateStats(UpdateStats *stats)
+	{
+		if (!songLoaded) return false;
+
+		*stats = updateStats;
+		return true;
+	}
+
 	void SetVolume(uint8_t volume)
 	{
 		masterVolume = volume;
@@ -2575,6 +6157,8 @@ namespace GXMPlayer
 
 	int32_t GetSongInfo()
 	{
+		if (!songLoaded) return 0;
+
 		return (songLength | (numOfPatterns << 8) | (numOfChannels << 16) | (numOfInstruments << 24));
 	}
 
@@ -2586,7 +6170,7 @@ namespace GXMPlayer
 		int i = 0;
 		while (i < numOfChannels)
 		{
-			if (Ch.active && Ch.samplePlaying != -1 && Ch.samplePlaying < totalSampleNum) result ++;
+			if (Ch.active && Ch.samplePlaying != -1) result ++;
 			i ++;
 		}
 
@@ -2605,7 +6189,7 @@ namespace GXMPlayer
 
 	int16_t GetPatLen(uint8_t patNum)
 	{
-		if (patNum >= numOfPatterns)
+		if (!songLoaded || patNum >= numOfPatterns)
 		{
 			return 0;
 		}
@@ -2615,7 +6199,7 @@ namespace GXMPlayer
 	Note GetNotePat(int16_t pos, int16_t row, uint8_t col)
 	{
 		Note thisNote;
-		if (pos < songLength)
+		if (songLoaded && pos < songLength)
 		{
 			while (row >= *(int16_t *)(patternData + patternAddr[orderTable[pos]]))
 			{
@@ -2634,7 +6218,7 @@ namespace GXMPlayer
 
 		if (col < numOfChannels)
 		{
-			thisNote = *(Note *)(patternData + patternAddr[orderTable[pos]] + ROW_SIZE_XM * row + col * NOTE_SIZE_XM + 2);
+			thisNote = PatternRow(orderTable[pos], row, viewRow)[col];
 		}
 		else
 		{
@@ -2724,17 +6308,8 @@ namespace GXMPlayer
 			delete customStream;
 #endif
 
-		if (channels != NULL)
-			free(channels);
-
-		if (patternData != NULL)
-			free(patternData);
-
-		if (instruments != NULL)
-			free(instruments);
-
-		if (samples != NULL)
-			free(samples);
+		FreeModuleData();
+		FreeArena();
 
 		/*
 		int i = 0;
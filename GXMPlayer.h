@@ -19,7 +19,63 @@ namespace GXMPlayer
         uint8_t Parameter;
     };
 
-    bool LoadModule(uint8_t *SongDataOrig, uint32_t SongDataLeng, bool UsingInterpolation = true, bool UseStereo = true, bool LoopSong = true, int BufSize = BUFFER_SIZE, int SmpRate = SMP_RATE);
+    struct ModuleInfo
+    {
+        char SongName[21];
+        char TrackerName[21];
+        uint16_t TrackerVersion;
+        int16_t SongLength;
+        int16_t RstPos;
+        int16_t NumOfChannels;
+        int16_t NumOfPatterns;
+        int16_t NumOfInstruments;
+        int16_t NumOfSamples;
+        int16_t DefaultSpd;
+        int16_t DefaultTempo;
+        bool UseAmigaFreqTable;
+        uint8_t OrderTable[256];
+        int32_t TotalRows;
+        uint32_t PatternDataSize;       //Unpacked pattern bytes
+        uint32_t SampleDataSize;        //Sample bytes stored in the module
+        uint32_t DecodedSampleSize;     //Sample bytes after decoding with the current settings (bidi loops, sample format)
+        uint32_t Int16SampleSize;       //Sample bytes after decoding with SetSampleFormat(1)
+        uint32_t FloatSampleSize;       //Sample bytes after decoding with SetSampleFormat(2)
+    };
+
+    struct MemoryStats
+    {
+        uint32_t PatternDataSize;       //Pattern bytes as stored (see SetCompactPatterns())
+        uint32_t SampleDataSize;        //Sample bytes as stored, the compressed blocks and their index with SetCompressSamples()
+        uint32_t InstrumentSize;
+        uint32_t SampleSize;            //Sample headers
+        uint32_t ChannelSize;           //With SetCompressSamples() the decoded block each channel plays from included
+        uint32_t EventSize;             //Non-empty cells of every row, read by the sequencer
+        uint32_t HotInstrumentSize;     //Instrument data read every tick, the volume and pan envelopes rasterised to one value per tick included
+        uint32_t SourceSize;            //Packed samples SetLazyDecoding() keeps until they are decoded
+        uint32_t AudioBufferSize;       //One buffer of BufSize stereo frames
+        uint64_t TotalSize;             //Sum of the above
+        uint64_t LoadPeakSize;          //Most bytes held at once during the last load, the source module included
+    };
+
+    struct UpdateStats
+    {
+        uint64_t ChannelTicks;          //Ticks of playing channels
+        uint64_t PeriodSkipped;         //Of those, ticks the delta was kept because the period didn't change
+        uint64_t VolumeSkipped;         //Ramp targets kept, volume, pan, envelopes and fade unchanged
+        uint64_t SampleSkipped;         //Sample length and loop kept, same sample playing
+    };
+
+    bool LoadModule(const uint8_t *SongDataOrig, uint32_t SongDataLeng, bool UsingInterpolation = true, bool UseStereo = true, bool LoopSong = true, int BufSize = BUFFER_SIZE, int SmpRate = SMP_RATE);
+    bool LoadModuleFromFile(const char *FileName, bool UsingInterpolation = true, bool UseStereo = true, bool LoopSong = true, int BufSize = BUFFER_SIZE, int SmpRate = SMP_RATE);
+    bool BeginModuleStream(bool UsingInterpolation = true, bool UseStereo = true, bool LoopSong = true, int BufSize = BUFFER_SIZE, int SmpRate = SMP_RATE);
+    int8_t FeedModuleStream(const uint8_t *Data, uint32_t Leng);    //1: loaded, 0: more data needed, -1: error. IsLoaded() is true once the patterns are in, the song can play from there
+    bool ProbeModule(const uint8_t *Data, uint32_t Leng, ModuleInfo *Info);
+    bool ProbeModuleFromFile(const char *FileName, ModuleInfo *Info);
+    uint64_t HashModule(const uint8_t *Data, uint32_t Leng);
+#ifndef _WIN32
+    bool LoadModuleFromFd(int Fd, bool UsingInterpolation = true, bool UseStereo = true, bool LoopSong = true, int BufSize = BUFFER_SIZE, int SmpRate = SMP_RATE);
+    bool LoadModuleCached(const char *FileName, const char *CacheDir, bool UsingInterpolation = true, bool UseStereo = true, bool LoopSong = true, int BufSize = BUFFER_SIZE, int SmpRate = SMP_RATE);
+#endif
     bool PlayModule();
     bool StopModule();
     void ResetModule();
@@ -33,6 +89,15 @@ namespace GXMPlayer
     void SetLoop(bool LoopSong = true);
     void SetPanMode(int8_t Mode = 0);
     void SetIgnoreF00(bool True);
+    void SetLazyDecoding(int16_t Orders = 0);    //Orders > 0: only samples used by the first Orders orders are decoded during loading
+    void SetUnrollBidiLoops(bool Unroll = true);  //false: bidi loops take no extra sample memory, used from the next load
+    void SetSampleFormat(int8_t Format = 0);      //0: as stored, 1: every sample widened to int16, 2: to float32, used from the next load
+    void SetCompressSamples(bool Compress = true);  //true: samples are kept in losslessly compressed blocks (bidi loops unrolled, SetSampleFormat() ignored), used from the next load
+    void SetCompactPatterns(bool Compact = true);   //true: patterns are kept packed and rows unpacked as they are played, used from the next load
+    void SetPruneUnused(bool Prune = true);        //true: patterns outside the order list and samples no note in them can play are not stored, used from the next load
+    int32_t GetPrunedSize();                        //Pattern and sample bytes the loaded module didn't store because of SetPruneUnused()
+    bool GetMemoryStats(MemoryStats *Stats);        //false if no module is loaded
+    bool GetUpdateStats(UpdateStats *Stats);        //Counted since the module was loaded or reset, false if no module is loaded
 
     bool IsLoaded();
     int16_t GetSpd();
@@ -0,0 +1,67 @@
+//Sample decoding benchmark
+//Reports delta decoding and bidi unrolling throughput for 8-bit and 16-bit sample data, guard frames included
+//
+//      make bench && ./bin64/decodebench [MB]
+
+#include "../GXMPlayer.cpp"
+
+#include <stdlib.h>
+
+using namespace GXMPlayer;
+
+static double Seconds(clock_t start, clock_t end)
+{
+    return (double)(end - start) / CLOCKS_PER_SEC;
+}
+
+//Decodes the same buffer until at least 1 second has passed, returns output GB/s
+static double Bench(const uint8_t *src, int8_t *dst, int32_t frames, int32_t reverseFrame, bool is16Bit)
+{
+    int32_t outBytes = is16Bit ? frames << 1 : frames;
+    int runs = 0;
+
+    clock_t start = clock();
+    clock_t end;
+    do
+    {
+        DecodeSample(src, dst, frames, reverseFrame, reverseFrame >= 0 ? 0 : -1, is16Bit);
+        runs ++;
+        end = clock();
+    }
+    while (Seconds(start, end) < 1.0);
+
+    return (double)outBytes * runs / Seconds(start, end) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int megaBytes = argc > 1 ? atoi(argv[1]) : 16;
+    if (megaBytes < 1) megaBytes = 1;
+
+    int32_t size = megaBytes << 20;
+    uint8_t *src = (uint8_t *)malloc(size);
+    int8_t *dstBase = (int8_t *)malloc(SampleStorageBytes(size, true, SAMPLE_NATIVE));
+    if (src == NULL || dstBase == NULL) return 1;
+
+    //Room for the guard frames on both sides
+    int8_t *dst = dstBase + (GUARD_FRAMES << 1);
+
+    srand(1);
+    for (int32_t i = 0; i < size; i ++)
+        src[i] = rand();
+
+    int32_t frames8 = size;
+    int32_t frames16 = size >> 1;
+
+    //Bidi: first half decoded, second half is the mirrored loop
+    printf("Decode buffer: %d MB\n", megaBytes);
+    printf("8-bit delta:       %6.2f GB/s\n", Bench(src, dst, frames8, -1, false));
+    printf("16-bit delta:      %6.2f GB/s\n", Bench(src, dst, frames16, -1, true));
+    printf("8-bit delta+bidi:  %6.2f GB/s\n", Bench(src, dst, frames8, frames8 >> 1, false));
+    printf("16-bit delta+bidi: %6.2f GB/s\n", Bench(src, dst, frames16, frames16 >> 1, true));
+
+    free(src);
+    free(dstBase);
+
+    return 0;
+}
@@ -0,0 +1,389 @@
+//Load time benchmark
+//Loads every .xm in a directory (subdirectories included) through LoadModule() and the other load
+//paths and reports the average time per load of each file and for the whole set, throughput and peak RSS.
+//LoadModule() is also split into its phases, each timed on its own and single threaded: header
+//parse (ParseSongHeader() and ValidateModule()), pattern unpack and sample decode
+//
+//      make bench-load && ./bin64/loadbench dir [iterations]
+
+#include "../GXMPlayer.cpp"
+
+#include <stdlib.h>
+#include <dirent.h>
+#include <sys/resource.h>
+
+using namespace GXMPlayer;
+
+#define STREAM_PIECE 65536
+
+enum LoadPhase
+{
+    PHASE_HEADER,
+    PHASE_PATTERNS,
+    PHASE_SAMPLES,
+    PHASE_LOAD,     //LoadModule()
+    PHASE_FILE,     //LoadModuleFromFile()
+    PHASE_STREAM,   //BeginModuleStream() and FeedModuleStream()
+    PHASE_CACHED,   //LoadModuleCached(), cache already built
+    PHASE_NUM
+};
+
+static const char *phaseNames[PHASE_NUM] = { "header", "patterns", "samples", "load", "file", "stream", "cached" };
+
+static char **files;
+static int32_t fileNum;
+static int32_t fileCap;
+
+static double Now()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool IsModuleName(const char *name)
+{
+    size_t leng = strlen(name);
+    return leng > 3 && strcasecmp(name + leng - 3, ".xm") == 0;
+}
+
+static int ComparePaths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static bool AddFiles(const char *dir)
+{
+    DIR *dirHandle = opendir(dir);
+    if (dirHandle == NULL) return true;
+
+    bool result = true;
+    struct dirent *ent;
+    while (result && (ent = readdir(dirHandle)) != NULL)
+    {
+        if (ent->d_name[0] == '.') continue;
+
+        char *path = (char *)malloc(strlen(dir) + strlen(ent->d_name) + 2);
+        if (path == NULL)
+        {
+            result = false;
+            break;
+        }
+        sprintf(path, "%s/%s", dir, ent->d_name);
+
+        struct stat fileStat;
+        if (stat(path, &fileStat) != 0)
+        {
+            free(path);
+            continue;
+        }
+
+        if (S_ISREG(fileStat.st_mode) && IsModuleName(ent->d_name))
+        {
+            if (fileNum >= fileCap)
+            {
+                int32_t newCap = fileCap ? fileCap * 2 : 256;
+                char **newFiles = (char **)realloc(files, newCap * sizeof(char *));
+                if (newFiles == NULL)
+                {
+                    free(path);
+                    result = false;
+                    break;
+                }
+                files = newFiles;
+                fileCap = newCap;
+            }
+
+            files[fileNum++] = path;
+            continue;
+        }
+
+        if (S_ISDIR(fileStat.st_mode))
+            result = AddFiles(path);
+
+        free(path);
+    }
+
+    closedir(dirHandle);
+    return result;
+}
+
+static uint8_t *ReadModule(const char *fileName, uint32_t &leng)
+{
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    leng = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *data = (uint8_t *)malloc(leng + 1);
+    if (data != NULL && fread(data, 1, leng, file) != leng)
+    {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(file);
+    return data;
+}
+
+//Header size, -1 if LoadModule() would reject the module
+static int32_t ParseHeader(const uint8_t *data, uint32_t leng)
+{
+    if (leng < 80) return -1;
+
+    int32_t headerSize = ParseSongHeader(data, leng);
+    return ValidateModule(data, leng, headerSize) ? headerSize : -1;
+}
+
+//Unpacks every pattern into scratch, returns where the instruments start
+static uint64_t UnpackPatterns(const uint8_t *data, uint64_t dataOfs, uint8_t *scratch)
+{
+    int16_t i = 0;
+    while (i < numOfPatterns)
+    {
+        uint32_t patHeaderSize = *(uint32_t *)(data + dataOfs);
+        uint16_t patternSize = *(uint16_t *)(data + dataOfs + 7);
+
+        if (patternSize > 0)
+            UnpackPattern(data + dataOfs + patHeaderSize, patternSize, scratch, PatternRows(data + dataOfs));
+
+        dataOfs += patHeaderSize + patternSize;
+        i ++;
+    }
+
+    return dataOfs;
+}
+
+//Decodes every sample into scratch as stored with bidi loops unrolled
+static void DecodeSamples(const uint8_t *data, uint32_t leng, uint64_t dataOfs, int8_t *scratch)
+{
+    int16_t i = 0;
+    while (i < numOfInstruments)
+    {
+        uint32_t instSize = *(uint32_t *)(data + dataOfs);
+        int16_t instSampleNum = *(int16_t *)(data + dataOfs + 27);
+        dataOfs += instSize;
+
+        if (instSampleNum > 0)
+        {
+            uint64_t sampleDataOfs = dataOfs + instSampleNum * 40;
+            int16_t j = 0;
+            while (j < instSampleNum)
+            {
+                uint8_t sampleHeader[40];
+                ClampSampleHeader(data + dataOfs + j * 40, sampleHeader, sampleDataOfs < leng ? leng - sampleDataOfs : 0);
+
+                int32_t reverseFrame;
+                int32_t frames = CalcSampleStorage(sampleHeader, reverseFrame, true);
+                DecodeSample(data + MIN(sampleDataOfs, (uint64_t)leng), scratch, frames, reverseFrame, LoopStartFrame(sampleHeader), sampleHeader[14] & 0x10);
+
+                sampleDataOfs += *(uint32_t *)(data + dataOfs + j * 40);
+                j ++;
+            }
+            dataOfs = sampleDataOfs;
+        }
+
+        i ++;
+    }
+}
+
+static bool StreamModule(const uint8_t *data, uint32_t leng)
+{
+    if (!BeginModuleStream()) return false;
+
+    uint32_t ofs = 0;
+    int8_t result = 0;
+    while (result == 0 && ofs < leng)
+    {
+        uint32_t piece = MIN(leng - ofs, (uint32_t)STREAM_PIECE);
+        result = FeedModuleStream(data + ofs, piece);
+        ofs += piece;
+    }
+
+    return result == 1;
+}
+
+//Runs one phase of one file, returns false if it failed
+//headerSize and instOfs are where the patterns and the instruments start
+static bool RunPhase(int phase, const char *fileName, const uint8_t *data, uint32_t leng, uint64_t headerSize, uint64_t instOfs,
+    const char *cacheDir, uint8_t *patternScratch, int8_t *sampleScratch)
+{
+    switch (phase)
+    {
+    case PHASE_HEADER:
+        return ParseHeader(data, leng) >= 0;
+    case PHASE_PATTERNS:
+        UnpackPatterns(data, headerSize, patternScratch);
+        return true;
+    case PHASE_SAMPLES:
+        DecodeSamples(data, leng, instOfs, sampleScratch);
+        return true;
+    case PHASE_LOAD:
+        return LoadModule(data, leng);
+    case PHASE_FILE:
+        return LoadModuleFromFile(fileName);
+    case PHASE_STREAM:
+        return StreamModule(data, leng);
+    case PHASE_CACHED:
+        return LoadModuleCached(fileName, cacheDir);
+    }
+
+    return false;
+}
+
+static void RemoveCache(const char *cacheDir)
+{
+    DIR *dirHandle = opendir(cacheDir);
+    if (dirHandle == NULL) return;
+
+    char path[PATH_MAX];
+    struct dirent *ent;
+    while ((ent = readdir(dirHandle)) != NULL)
+    {
+        if (ent->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", cacheDir, ent->d_name);
+        unlink(path);
+    }
+
+    closedir(dirHandle);
+    rmdir(cacheDir);
+}
+
+static void PrintRow(const char *name, uint64_t bytes, const double *seconds, uint64_t loadPeak)
+{
+    printf("%-28.28s %8llu", name, (unsigned long long)(bytes >> 10));
+
+    int phase = 0;
+    while (phase < PHASE_NUM)
+    {
+        printf(" %9.1f", seconds[phase] * 1e6);
+        phase ++;
+    }
+
+    printf(" %8.1f %8llu\n", seconds[PHASE_LOAD] > 0 ? bytes / seconds[PHASE_LOAD] / 1e6 : 0, (unsigned long long)(loadPeak >> 10));
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("loadbench dir [iterations]\n");
+        return 1;
+    }
+
+    int iterations = argc > 2 ? atoi(argv[2]) : 10;
+    if (iterations < 1) iterations = 1;
+
+    if (!AddFiles(argv[1]) || fileNum == 0)
+    {
+        printf("No modules in %s\n", argv[1]);
+        return 1;
+    }
+    qsort(files, fileNum, sizeof(char *), ComparePaths);
+
+    char cacheDir[] = "/tmp/loadbenchXXXXXX";
+    if (mkdtemp(cacheDir) == NULL)
+    {
+        printf("Can't create a cache directory\n");
+        return 1;
+    }
+
+    uint8_t *patternScratch = (uint8_t *)malloc(256 * NOTE_SIZE_XM * CHANNELS_MAX);
+    if (patternScratch == NULL) return 1;
+
+    printf("%d iterations, times in us per load\n\n", iterations);
+    printf("%-28s %8s", "file", "KB");
+    int phase = 0;
+    while (phase < PHASE_NUM)
+        printf(" %9s", phaseNames[phase++]);
+    printf(" %8s %8s\n", "MB/s", "peak KB");
+
+    double totalSeconds[PHASE_NUM] = { 0 };
+    uint64_t totalBytes = 0;
+    uint64_t maxLoadPeak = 0;
+    int32_t loadedNum = 0;
+
+    int32_t i = 0;
+    while (i < fileNum)
+    {
+        const char *fileName = files[i++];
+        const char *baseName = strrchr(fileName, '/') ? strrchr(fileName, '/') + 1 : fileName;
+
+        uint32_t leng;
+        uint8_t *data = ReadModule(fileName, leng);
+        int32_t headerSize = data != NULL ? ParseHeader(data, leng) : -1;
+        if (headerSize < 0 || !LoadModule(data, leng))
+        {
+            printf("%-28.28s invalid\n", baseName);
+            if (data != NULL) free(data);
+            continue;
+        }
+
+        MemoryStats stats = {};
+        GetMemoryStats(&stats);
+        uint64_t instOfs = UnpackPatterns(data, headerSize, patternScratch);
+
+        //Room for the largest sample, 16-bit with its bidi loop unrolled, and the guard frames
+        int8_t *sampleBase = (int8_t *)malloc(SampleStorageBytes(leng, true, SAMPLE_NATIVE));
+        if (sampleBase == NULL) return 1;
+        int8_t *sampleScratch = sampleBase + GUARD_FRAMES * 2;
+
+        //Builds the cache entry and warms up every path
+        LoadModuleCached(fileName, cacheDir);
+
+        double seconds[PHASE_NUM];
+        bool failed = false;
+        phase = 0;
+        while (phase < PHASE_NUM)
+        {
+            double start = Now();
+            int run = 0;
+            while (run < iterations)
+            {
+                failed |= !RunPhase(phase, fileName, data, leng, headerSize, instOfs, cacheDir, patternScratch, sampleScratch);
+                run ++;
+            }
+            seconds[phase] = (Now() - start) / iterations;
+            totalSeconds[phase] += seconds[phase];
+            phase ++;
+        }
+
+        PrintRow(baseName, leng, seconds, stats.loadPeakSize);
+        if (failed) printf("%-28.28s a load path failed\n", "");
+
+        totalBytes += leng;
+        maxLoadPeak = MAX(maxLoadPeak, stats.loadPeakSize);
+        loadedNum ++;
+
+        free(sampleBase);
+        free(data);
+    }
+
+    printf("\n");
+    PrintRow("all", totalBytes, totalSeconds, maxLoadPeak);
+
+    printf("\n%d of %d modules loaded, %.2f MB\n", loadedNum, fileNum, totalBytes / 1e6);
+    phase = PHASE_LOAD;
+    while (phase < PHASE_NUM)
+    {
+        printf("%-8s %8.1f MB/s\n", phaseNames[phase], totalSeconds[phase] > 0 ? totalBytes / totalSeconds[phase] / 1e6 : 0);
+        phase ++;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("Peak RSS %ld KB\n", usage.ru_maxrss);
+
+    CleanUp();
+    RemoveCache(cacheDir);
+
+    free(patternScratch);
+    i = 0;
+    while (i < fileNum)
+        free(files[i++]);
+    free(files);
+
+    return 0;
+}
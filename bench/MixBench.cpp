@@ -0,0 +1,212 @@
+//Mixer benchmark
+//Renders a module (or a generated one with every channel playing a looped sample) as fast as
+//possible and reports output frames per second and how many times faster than real time that is
+//Modules with bidi loops are run with unrolled and with native bidi loops, "bidi" makes the
+//generated sample ping-pong, "int16" or "float" widens every sample (SetSampleFormat()) and
+//"compressed" runs the mixer on compressed samples (SetCompressSamples())
+//Also prints how many per channel recomputations UpdateChannelInfo() skipped (GetUpdateStats())
+//
+//      make bench && ./bin64/mixbench [file.xm | channels] [bidi] [int16 | float | compressed]
+
+#include "../GXMPlayer.cpp"
+
+#include <stdlib.h>
+
+using namespace GXMPlayer;
+
+#define BENCH_BUFFER 4096
+
+static double Seconds(clock_t start, clock_t end)
+{
+    return (double)(end - start) / CLOCKS_PER_SEC;
+}
+
+//One 64 row pattern with a note on every channel in the first row and one instrument with a
+//4096 frame looped 8-bit sample, the song loops on that pattern
+static uint8_t *MakeModule(int channels, bool bidi, uint32_t &leng)
+{
+    const int32_t sampleLeng = 4096;
+    const int32_t patternSize = channels * 3 + 63 * channels;
+    const int32_t instSize = 263;
+
+    leng = 60 + 276 + 9 + patternSize + instSize + 40 + sampleLeng;
+    uint8_t *data = (uint8_t *)calloc(leng, 1);
+    if (data == NULL) return NULL;
+
+    memcpy(data, "Extended Module: ", 17);
+    memcpy(data + 17, "MixBench", 8);
+    data[37] = 0x1A;
+    *(uint16_t *)(data + 58) = 0x0104;
+
+    *(uint32_t *)(data + 60) = 276;
+    *(int16_t *)(data + 64) = 1;
+    *(int16_t *)(data + 68) = channels;
+    *(int16_t *)(data + 70) = 1;
+    *(int16_t *)(data + 72) = 1;
+    *(int16_t *)(data + 74) = 1;
+    *(int16_t *)(data + 76) = 6;
+    *(int16_t *)(data + 78) = 125;
+
+    uint8_t *pattern = data + 60 + 276;
+    *(uint32_t *)(pattern) = 9;
+    *(int16_t *)(pattern + 5) = 64;
+    *(uint16_t *)(pattern + 7) = patternSize;
+
+    //C-4 spread over a few octaves so the channels step through the sample at different rates
+    uint8_t *note = pattern + 9;
+    int i = 0;
+    while (i < channels)
+    {
+        *note++ = 0x83;
+        *note++ = 37 + (i * 7) % 48;
+        *note++ = 1;
+        i ++;
+    }
+    memset(note, 0x80, 63 * channels);
+
+    uint8_t *inst = pattern + 9 + patternSize;
+    *(uint32_t *)(inst) = instSize;
+    memcpy(inst + 4, "Loop", 4);
+    *(int16_t *)(inst + 27) = 1;
+    *(uint32_t *)(inst + 29) = 40;
+
+    uint8_t *sampleHeader = inst + instSize;
+    *(uint32_t *)(sampleHeader) = sampleLeng;
+    *(uint32_t *)(sampleHeader + 4) = 0;
+    *(uint32_t *)(sampleHeader + 8) = sampleLeng;
+    sampleHeader[12] = 64;
+    sampleHeader[14] = bidi ? 2 : 1;
+    sampleHeader[15] = 128;
+
+    //Delta coded triangle wave
+    int8_t *sampleBytes = (int8_t *)(sampleHeader + 40);
+    int8_t prev = 0;
+    int32_t k = 0;
+    while (k < sampleLeng)
+    {
+        int8_t value = (int8_t)((k & 255) < 128 ? (k & 127) - 64 : 63 - (k & 127));
+        sampleBytes[k] = value - prev;
+        prev = value;
+        k ++;
+    }
+
+    return data;
+}
+
+static uint8_t *ReadModule(const char *fileName, uint32_t &leng)
+{
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    leng = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *data = (uint8_t *)malloc(leng);
+    if (data != NULL && fread(data, 1, leng, file) != leng)
+    {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(file);
+    return data;
+}
+
+//Mixes until at least 2 seconds have passed, returns output frames per second
+static double Bench()
+{
+    int16_t *buffer = (int16_t *)malloc(BENCH_BUFFER * 4);
+    if (buffer == NULL) return 0;
+
+    isPlaying = true;
+    int64_t frames = 0;
+
+    clock_t start = clock();
+    clock_t end;
+    do
+    {
+        int i = 0;
+        while (i < 16)
+        {
+            FillBuffer(buffer);
+            i ++;
+        }
+        frames += BENCH_BUFFER * 16;
+        end = clock();
+    }
+    while (Seconds(start, end) < 2.0);
+
+    isPlaying = false;
+    free(buffer);
+
+    return frames / Seconds(start, end);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t leng = 0;
+    uint8_t *data;
+    bool bidi = false;
+    int8_t format = SAMPLE_NATIVE;
+
+    int arg = 2;
+    while (arg < argc)
+    {
+        if (strcmp(argv[arg], "bidi") == 0) bidi = true;
+        else if (strcmp(argv[arg], "int16") == 0) format = SAMPLE_INT16;
+        else if (strcmp(argv[arg], "float") == 0) format = SAMPLE_FLOAT;
+        else if (strcmp(argv[arg], "compressed") == 0) SetCompressSamples(true);
+        arg ++;
+    }
+    SetSampleFormat(format);
+
+    if (argc > 1 && strspn(argv[1], "0123456789") != strlen(argv[1]))
+    {
+        data = ReadModule(argv[1], leng);
+        bidi = true;
+    }
+    else
+    {
+        int channels = argc > 1 ? atoi(argv[1]) : 32;
+        channels = MAX(MIN(channels, CHANNELS_MAX), 1);
+        data = MakeModule(channels, bidi, leng);
+    }
+
+    if (data == NULL)
+    {
+        printf("Can't load %s\n", argv[1]);
+        return 1;
+    }
+
+    static const char *formatNames[] = { "", "int16", "float" };
+
+    //Bit 0: interpolation, bit 1: native bidi loops
+    int mode = 0;
+    while (mode < (bidi ? 4 : 2))
+    {
+        bool useInterpolation = mode & 1;
+        SetUnrollBidiLoops(!(mode & 2));
+        if (!LoadModule(data, leng, useInterpolation, true, true, BENCH_BUFFER, SMP_RATE))
+        {
+            printf("Invalid module\n");
+            free(data);
+            return 1;
+        }
+
+        double framesPerSec = Bench();
+        printf("%d channels, %-13s %-9s %-6s %8.2f M frames/s  %7.1fx real time  %8d KB samples\n", numOfChannels, useInterpolation ? "interpolated" : "nearest", bidi ? (mode & 2 ? "native" : "unrolled") : "",
+            compressSamples ? "packed" : formatNames[format], framesPerSec / 1e6, framesPerSec / SMP_RATE, totalSampleSize >> 10);
+
+        UpdateStats stats;
+        if (GetUpdateStats(&stats) && stats.channelTicks > 0)
+            printf("%llu channel ticks, skipped: delta %.1f%%  ramp targets %.1f%%  sample loop %.1f%%\n", (unsigned long long)stats.channelTicks,
+                stats.periodSkipped * 100.0 / stats.channelTicks, stats.volumeSkipped * 100.0 / stats.channelTicks, stats.sampleSkipped * 100.0 / stats.channelTicks);
+        mode ++;
+    }
+
+    CleanUp();
+    free(data);
+
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include <termios.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/poll.h>
 #include <iostream>
@@ -10,22 +11,22 @@
 #include <stdlib.h>
 #include <time.h>
 #include <signal.h>
+#include <errno.h>
 #include "GXMPlayer.h"
 #include "GXMPatternView.h"
+#include "GXMIndexer.h"
 
 using namespace std;
 using namespace GXMPlayer;
 using namespace GXMPatternView;
 
-static ifstream InputFile;
-static char *FileData;
-
 static bool UseStereo = true;
 static bool UseInterpolation = false;
 static bool UsePatternView = false;
 static bool DetailedView = true;
 static bool UseLoop = true;
 static bool IgnoreF00 = true;
+static bool MemStats = false;
 static int8_t PanMode = 0;
 
 static char StatChars[9] = "        ";
@@ -90,10 +91,7 @@ void ProcessArguments(int argc, char *argv[])
     for (int i = 0; i < argc; i ++)
     {
         if (i == 1)
-        {
             FileName = argv[i];
-            InputFile.open(FileName/*, ios_base::binary*/);
-        }
         if (i > 1)
         {
             if (!Parsing)
@@ -119,6 +117,9 @@ void ProcessArguments(int argc, char *argv[])
                     DetailedView = false;
                 }
 
+                if (strcmp(argv[i], "--mem-stats") == 0)
+                    MemStats = true;
+
                 if (strcmp(argv[i], "-s") == 0)
                     Parsing = 1;
 
@@ -169,6 +170,24 @@ void ProcessArguments(int argc, char *argv[])
     }
 }
 
+void PrintMemoryStats()
+{
+    MemoryStats Stats;
+    if (!GXMPlayer::GetMemoryStats(&Stats)) return;
+
+    printf("Patterns:     %10u\n", Stats.PatternDataSize);
+    printf("Samples:      %10u\n", Stats.SampleDataSize);
+    printf("Instruments:  %10u\n", Stats.InstrumentSize);
+    printf("Sample table: %10u\n", Stats.SampleSize);
+    printf("Channels:     %10u\n", Stats.ChannelSize);
+    printf("Events:       %10u\n", Stats.EventSize);
+    printf("Hot instr.:   %10u\n", Stats.HotInstrumentSize);
+    printf("Source:       %10u\n", Stats.SourceSize);
+    printf("Audio buffer: %10u\n", Stats.AudioBufferSize);
+    printf("Total:        %10llu\n", (unsigned long long)Stats.TotalSize);
+    printf("Load peak:    %10llu\n", (unsigned long long)Stats.LoadPeakSize);
+}
+
 void ExitSig(int Sig)
 {
     reset_input_mode();
@@ -181,11 +200,15 @@ int main(int argc, char *argv[])
 {
     signal(SIGINT, ExitSig);
 
+    if (argc >= 3 && strcmp(argv[1], "index") == 0)
+        return GXMIndexer::BuildIndex(argv[2]) ? 0 : 1;
+
     ProcessArguments(argc, argv);
 
     if (argc == 1)
     {
-        cout << "\ngxm file [options]\n" << endl;
+        cout << "\ngxm file [options]  (file \"-\" reads the module from stdin)" << endl;
+        cout << "gxm index dir       Build or refresh the module index of dir (dir/.gxmindex)\n" << endl;
         cout << "    -i               Use interpolation    " << endl;
         cout << "    --no-stereo      Disable stereo" << endl;
         cout << "    --no-repeat      Replay whole song after finishing playing the song\n" << endl;
@@ -193,6 +216,7 @@ int main(int argc, char *argv[])
         cout << "    --pan-mode mode  Set panning mode (0: FT2, other: Linear, Default: 0)\n" << endl;
         cout << "    --pattern        Enable pattern viewer (Detailed)" << endl;
         cout << "    --pattern2       Enable pattern viewer\n" << endl;
+        cout << "    --mem-stats      Print the memory the module takes in bytes and exit\n" << endl;
         cout << "    -s rate          Set sampling rate (Default: 44100, 8000 < rate < 192000)" << endl;
         cout << "    -b size          Set buffer size in ms (Default: 100, 1 < size < 1000)" << endl;
         cout << "    -a amp           Set amplifier (Default: 1.0, 0.1 < amp < 10)\n" << endl;
@@ -213,31 +237,68 @@ int main(int argc, char *argv[])
 
     BufSize = SmpRate * BufTime / 1000;
 
-    struct winsize WinSize;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &WinSize);
+    if (!MemStats)
+    {
+        struct winsize WinSize;
+        ioctl(STDOUT_FILENO, TIOCGWINSZ, &WinSize);
+
+        for (int i = 0; i < WinSize.ws_row; i ++)
+        {
+            cout << "\n";
+        }
+
+        //cout << endl;
+        cout << "\u001b[2J";
+        cout << "\u001b[0;0H";
+    }
 
-    for (int i = 0; i < WinSize.ws_row; i ++)
+    bool Loaded;
+    bool Started = false;
+    if (strcmp(FileName, "-") == 0)
     {
-        cout << "\n";
+        //Module piped in, parse it while it arrives and start playing once the patterns are in,
+        //then take the keyboard back
+        int8_t Result = GXMPlayer::BeginModuleStream(UseInterpolation, UseStereo, UseLoop, BufSize, SmpRate) ? 0 : -1;
+        uint8_t Chunk[65536];
+        while (Result == 0)
+        {
+            ssize_t ReadLeng = read(STDIN_FILENO, Chunk, sizeof(Chunk));
+            if (ReadLeng < 0 && errno == EINTR) continue;
+            if (ReadLeng <= 0) break;
+
+            Result = GXMPlayer::FeedModuleStream(Chunk, ReadLeng);
+            if (!Started && !MemStats && GXMPlayer::IsLoaded()) Started = GXMPlayer::PlayModule();
+        }
+
+        //Cut short once playing, it keeps playing what arrived
+        Loaded = Result == 1 || Started;
+
+        int Tty = open("/dev/tty", O_RDONLY);
+        if (Tty >= 0)
+        {
+            dup2(Tty, STDIN_FILENO);
+            close(Tty);
+        }
     }
+    else
+    {
+        if (access(FileName, R_OK) != 0)
+        {
+            cout << "Failed to open file " << FileName << endl;
+            return 0;
+        }
 
-    //cout << endl;
-    cout << "\u001b[2J";
-    cout << "\u001b[0;0H";
+        Loaded = GXMPlayer::LoadModuleFromFile(FileName, UseInterpolation, UseStereo, UseLoop, BufSize, SmpRate);
+    }
 
-    if (!InputFile)
+    if (Loaded && MemStats)
     {
-        cout << "Failed to open file " << FileName << endl;
+        PrintMemoryStats();
+        GXMPlayer::CleanUp();
         return 0;
     }
-    InputFile.seekg(0, ios_base::end);
-    int FileSize = InputFile.tellg();
-
-    FileData = (char *)malloc(FileSize);
-    InputFile.seekg(0, ios_base::beg);
-    InputFile.read(FileData, FileSize);
 
-    if (!GXMPlayer::LoadModule((uint8_t *)FileData, FileSize, UseInterpolation, UseStereo, UseLoop, BufSize, SmpRate) || !GXMPlayer::PlayModule())
+    if (!Loaded || (!Started && !GXMPlayer::PlayModule()))
     {
         cout << "Failed to load file." << endl;
         return 0;
@@ -257,9 +318,6 @@ int main(int argc, char *argv[])
     uint8_t SongLeng = SongInfo & 0xFF;
     printf("Length: %d, Channels: %d, Instruments: %d, Patterns: %d\n\n", SongLeng, NumOfChn, NumOfInstr, NumOfPat);
 
-    InputFile.close();
-    free(FileData);
-
     cout << "\u001b[s";
     //cout << "\u001b[=7l";
     cout << "\u001b[?25l";